@@ -0,0 +1,158 @@
+/*
+ * bench.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Benchmarks of the main processing routines on synthetic
+ * star fields. Each benchmark is run {warmup} times untimed
+ * and then {reps} times timed, reporting the minimum, median
+ * and mean wall time and the throughput in megapixels and
+ * frames per second. Results are written as JSON so runs can
+ * be compared.
+ *
+ * Usage: bench [-W width] [-H height] [-n frames] [-s stars]
+ *              [--seed seed] [--warmup n] [-r reps]
+ *              [--only name,name,...] [-o output.json]
+ *
+ */
+
+#include "enhance.h"
+
+// Discards everything written to it, to keep the routines' progress output out of the timings
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+struct Result {
+    std::string name;
+    size_t frames;
+    double megapixels;              // Per frame
+    std::vector<double> times;      // Seconds, one per repetition
+};
+
+// Run {fn} {warmup} + {reps} times with anything it prints discarded, timing the last {reps}
+template <typename F>
+Result run(const std::string &name, const size_t frames, const double megapixels,
+           const size_t warmup, const size_t reps, F fn) {
+    Result result {name, frames, megapixels, {}};
+    std::cout << std::left << std::setw(16) << name << std::flush;
+
+    NullBuffer null;
+    std::streambuf* stdout_buf = std::cout.rdbuf(&null);
+    for (size_t ii = 0; ii < warmup; ii ++) fn();
+    for (size_t ii = 0; ii < reps; ii ++) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        result.times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::cout.rdbuf(stdout_buf);
+
+    std::vector<double> sorted = result.times;
+    std::sort(sorted.begin(), sorted.end());
+    const double median = sorted[sorted.size() / 2];
+    std::cout << std::right << std::fixed << std::setprecision(4) << std::setw(10) << median << " s "
+              << std::setprecision(1) << std::setw(10) << frames * megapixels / median << " MP/s "
+              << std::setw(8) << frames / median << " frames/s" << std::endl;
+    return result;
+}
+
+void write_json(const std::string &file, const FieldSpec &spec, const std::vector<Result> &results) {
+    std::ofstream out(file);
+    out << std::setprecision(6);
+    out << "{\n";
+    out << "  \"date\": \"" << datetime() << "\",\n";
+    out << "  \"threads\": " << omp_get_max_threads() << ",\n";
+    out << "  \"spec\": {\"width\": " << spec.width << ", \"height\": " << spec.height << ", \"frames\": " << spec.frames
+        << ", \"stars\": " << spec.stars << ", \"seed\": " << spec.seed << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t ii = 0; ii < results.size(); ii ++) {
+        const Result &r = results[ii];
+        std::vector<double> sorted = r.times;
+        std::sort(sorted.begin(), sorted.end());
+        const double median = sorted[sorted.size() / 2];
+        const double mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+        out << "    {\"name\": \"" << r.name << "\", \"frames\": " << r.frames << ", \"megapixels\": " << r.megapixels
+            << ", \"reps\": " << sorted.size() << ", \"min_s\": " << sorted.front() << ", \"median_s\": " << median
+            << ", \"mean_s\": " << mean << ", \"mp_per_s\": " << r.frames * r.megapixels / median
+            << ", \"frames_per_s\": " << r.frames / median << "}" << (ii + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argn, char** argv) {
+    std::cout << res;
+    FieldSpec spec;
+    size_t warmup;
+    size_t reps;
+    std::string only;
+    std::string ofile;
+
+    po::options_description description("Usage");
+    try {
+        description.add_options()
+            ("width,W", po::value<int>(&spec.width)->default_value(1920), "Width of the synthetic frames.")
+            ("height,H", po::value<int>(&spec.height)->default_value(1080), "Height of the synthetic frames.")
+            ("frames,n", po::value<size_t>(&spec.frames)->default_value(16), "Frames in the synthetic stack.")
+            ("stars,s", po::value<size_t>(&spec.stars)->default_value(2000), "Stars in the synthetic field.")
+            ("seed", po::value<uint64_t>(&spec.seed)->default_value(1), "Seed of the synthetic field.")
+            ("warmup", po::value<size_t>(&warmup)->default_value(1), "Untimed runs before timing.")
+            ("reps,r", po::value<size_t>(&reps)->default_value(5), "Timed runs.")
+            ("only", po::value<std::string>(&only), "Comma separated list of the benchmarks to run (default all).")
+            ("output,o", po::value<std::string>(&ofile)->default_value("bench.json"), "JSON results file.")
+        ;
+    }
+    catch (...) {
+        std::cout << "Error in boost program options initialization" << std::endl;
+        exit(1);
+    }
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argn, argv).options(description).run(), vm);
+        po::notify(vm);
+    }
+    catch (...) {
+        std::cout << description << std::endl;
+        exit(2);
+    }
+    if (spec.frames < 2 || reps < 1) {
+        std::cout << "Error - need at least 2 frames and 1 repetition." << std::endl;
+        exit(3);
+    }
+
+    max_features = 10000;
+    good_match_percent = 0.01;
+    separation_adjustment = 0.05;
+    draw = false;
+
+    std::cout << "Generating " << spec.frames << " frames of " << spec.width << "x" << spec.height << "..." << std::endl;
+    const std::vector<cv::Mat> frames = synthetic_frames(spec);
+    const cv::Mat frame = frames[0];
+    const cv::Mat mask = gaussian_find(frame, 8);
+    const double mp = spec.width * (double)spec.height / 1e6;
+    const size_t n = spec.frames;
+
+    const auto selected = [&](const std::string &name) {
+        return only.empty() || ("," + only + ",").find("," + name + ",") != std::string::npos;
+    };
+    std::vector<Result> results;
+    const auto bench = [&](const std::string &name, const size_t count, auto fn) {
+        if (selected(name)) results.push_back(run(name, count, mp, warmup, reps, fn));
+    };
+
+    bench("coadd", n, [&] { coadd(frames); });
+    bench("median_coadd", n, [&] { median_coadd(frames); });
+    bench("gaussian_find", 1, [&] { gaussian_find(frame, 8); });
+    bench("brightness_find", 1, [&] { brightness_find(frame); });
+    bench("depollute", 1, [&] { cv::Mat image = frame.clone(); depollute(image); });
+    bench("median_filter", 1, [&] { median_filter(frame); });
+    bench("align_images", 1, [&] { cv::Mat a = frames[1], b = frame, reg; align_images(a, b, reg); });
+    bench("align_stars", 1, [&] { cv::Mat a = frame, b = frames[1], reg; align_stars(a, b, reg); });
+    bench("star_trail", n, [&] { star_trail(frames); });
+    bench("blob_extract", 1, [&] { blob_extract(mask); });
+
+    write_json(ofile, spec, results);
+    std::cout << "Results written to " << yellow << ofile << res << std::endl;
+    return 0;
+}
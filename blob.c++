@@ -12,8 +12,17 @@
 
 Blob::Blob() {}
 
-void Blob::to_blob(Pos p) { if (!blob_contains(p)) blob.push_back(p); }
-void Blob::to_perim(Pos p) { if (!perim_contains(p)) perim.push_back(p); }
+// Appending is constant time, duplicates are only removed by [compact] so that building
+// a blob pixel by pixel stays linear
+void Blob::to_blob(Pos p) { blob.push_back(p); }
+void Blob::to_perim(Pos p) { perim.push_back(p); }
 
-bool Blob::blob_contains(Pos p) { return (std::find(blob.begin(), blob.end(), p) != blob.end()); }
-bool Blob::perim_contains(Pos p) { return (std::find(perim.begin(), perim.end(), p) != perim.end()); }
+void Blob::compact() {
+    std::sort(blob.begin(), blob.end());
+    blob.erase(std::unique(blob.begin(), blob.end()), blob.end());
+    std::sort(perim.begin(), perim.end());
+    perim.erase(std::unique(perim.begin(), perim.end()), perim.end());
+}
+
+bool Blob::blob_contains(Pos p) const { return std::binary_search(blob.begin(), blob.end(), p); }
+bool Blob::perim_contains(Pos p) const { return std::binary_search(perim.begin(), perim.end(), p); }
@@ -28,8 +28,9 @@ public:
 
     void to_blob(Pos p);
     void to_perim(Pos p);
+    void compact();             // Sort and remove duplicates, needed before the contains queries
 
-    bool blob_contains(Pos p);
-    bool perim_contains(Pos p);
+    bool blob_contains(Pos p) const;
+    bool perim_contains(Pos p) const;
 
 };
@@ -0,0 +1,254 @@
+/*
+ * calibrate.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of calibration master building, caching
+ * and the fused calibration kernel.
+ *
+ */
+
+#include "calibrate.h"
+#include "enhance.h"
+
+// Layout of a cached masters file - this header padded to {map_align} bytes, then each present
+// plane in the order bias, dark, flat, hot, each padded to {map_align} bytes
+struct CacheHeader {
+    char magic[8];
+    int32_t rows, cols, channels, planes;
+    double exposure;
+    int32_t iso, reserved;
+    double temperature;
+};
+const char cache_magic[8] = {'E', 'N', 'H', 'C', 'A', 'L', '0', '1'};
+enum CachePlane { cache_bias = 1, cache_dark = 2, cache_flat = 4, cache_hot = 8 };
+
+// Smallest flat value divided by, so that dead or vignetted-out pixels cannot blow up
+const float min_flat = 1e-3;
+
+std::string CalibrationKey::name() const {
+    std::stringstream ss;
+    ss << "e" << exposure << "_iso" << iso << "_t" << temperature;
+    return ss.str();
+}
+
+cv::Mat master_frame(const std::vector<std::string> &files, const Reduction mode, const double kappa, const size_t iters) {
+    return reduce_stack(read_images(files), mode, kappa, iters, CV_32F);
+}
+
+Calibration build_masters(const std::vector<std::string> &bias, const std::vector<std::string> &darks,
+                          const std::vector<std::string> &flats, const CalibrationKey &key,
+                          const double kappa, const double z) {
+    Calibration cal;
+    cal.key = key;
+    if (!bias.empty()) {
+        std::cout << "Building master bias..." << std::endl;
+        cal.bias = master_frame(bias, Reduction::sigma_clip, kappa);
+    }
+    if (!darks.empty()) {
+        std::cout << "Building master dark..." << std::endl;
+        cal.dark = master_frame(darks, Reduction::sigma_clip, kappa);
+        if (!cal.bias.empty() && cal.bias.size() == cal.dark.size()) cv::subtract(cal.dark, cal.bias, cal.dark);
+        if (!cal.dark.empty()) cal.hot = hot_pixel_map(cal.dark, z);
+    }
+    if (!flats.empty()) {
+        std::cout << "Building master flat..." << std::endl;
+        cal.flat = master_frame(flats, Reduction::sigma_clip, kappa);
+        if (!cal.bias.empty() && cal.bias.size() == cal.flat.size()) cv::subtract(cal.flat, cal.bias, cal.flat);
+
+        // Normalize each channel separately so the flat also removes any colour cast of the panel
+        const cv::Scalar mean = cv::mean(cal.flat);
+        const int nb = cal.flat.channels();
+#pragma omp parallel for schedule(static)
+        for (int r = 0; r < cal.flat.rows; r ++) {
+            float* f = cal.flat.ptr<float>(r);
+            for (int c = 0; c < cal.flat.cols; c ++) {
+                for (int k = 0; k < nb; k ++) f[c * nb + k] /= mean[k] > 0 ? mean[k] : 1;
+            }
+        }
+    }
+
+    // Masters of different sizes cannot be applied together
+    cv::Mat first;
+    for (auto *m : {&cal.bias, &cal.dark, &cal.flat}) {
+        if (m->empty()) continue;
+        if (first.empty()) first = *m;
+        else if (m->size() != first.size() || m->type() != first.type()) {
+            std::cout << "Error - calibration frames differ in shape or channels, discarding masters." << std::endl;
+            return Calibration();
+        }
+    }
+    return cal;
+}
+
+cv::Mat hot_pixel_map(const cv::Mat &dark, const double z) {
+    cv::Mat mean, stddev;
+    cv::meanStdDev(dark, mean, stddev);
+    const int nb = dark.channels();
+    std::vector<float> limit(nb);
+    for (int k = 0; k < nb; k ++) limit[k] = mean.at<double>(k) + z * stddev.at<double>(k);
+
+    cv::Mat hot = cv::Mat::zeros(dark.rows, dark.cols, CV_8UC1);
+    long count = 0;
+#pragma omp parallel for schedule(static) reduction(+:count)
+    for (int r = 0; r < dark.rows; r ++) {
+        const float* d = dark.ptr<float>(r);
+        uchar* h = hot.ptr(r);
+        for (int c = 0; c < dark.cols; c ++) {
+            for (int k = 0; k < nb; k ++) {
+                if (d[c * nb + k] > limit[k]) {
+                    h[c] = 255;
+                    count ++;
+                    break;
+                }
+            }
+        }
+    }
+    std::cout << "Found " << count << " hot pixels." << std::endl;
+    return hot;
+}
+
+bool save_masters(const Calibration &cal, const std::string &dir) {
+    if (cal.empty()) return false;
+    const cv::Mat &first = !cal.bias.empty() ? cal.bias : !cal.dark.empty() ? cal.dark : cal.flat;
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.rows = first.rows;
+    header.cols = first.cols;
+    header.channels = first.channels();
+    header.planes = (cal.bias.empty() ? 0 : cache_bias) | (cal.dark.empty() ? 0 : cache_dark)
+                  | (cal.flat.empty() ? 0 : cache_flat) | (cal.hot.empty() ? 0 : cache_hot);
+    header.exposure = cal.key.exposure;
+    header.iso = cal.key.iso;
+    header.temperature = cal.key.temperature;
+
+    const fs::path path = fs::path(dir) / (cal.key.name() + ".cal");
+    const bool written = atomic_write(path.string(), [&](std::ofstream &out) {
+        write_aligned(out, &header, sizeof(header));
+        for (const auto *m : {&cal.bias, &cal.dark, &cal.flat, &cal.hot}) if (!m->empty()) write_plane(out, *m);
+    }, "calibration cache");
+    if (written) std::cout << "Cached masters in " << yellow << path.string() << res << std::endl;
+    return written;
+}
+
+Calibration load_masters(const CalibrationKey &key, const std::string &dir) {
+    const fs::path path = fs::path(dir) / (key.name() + ".cal");
+    std::error_code ec;
+    if (!fs::exists(path, ec)) return Calibration();
+
+    // Private mapping so that an accidental write to a master never reaches the cache
+    const MappedFile mapped = map_readonly_private(path.string(), "calibration cache", sizeof(CacheHeader));
+    if (mapped.empty()) return Calibration();
+    const size_t len = mapped.size;
+
+    Calibration cal;
+    cal.key = key;
+    cal.mapping = mapped.mapping;
+
+    const CacheHeader &header = *(const CacheHeader*)mapped.data;
+    const size_t pixels = (size_t)header.rows * header.cols;
+    size_t expected = map_aligned(sizeof(CacheHeader));
+    for (int p : {cache_bias, cache_dark, cache_flat}) if (header.planes & p) expected += map_aligned(pixels * header.channels * sizeof(float));
+    if (header.planes & cache_hot) expected += map_aligned(pixels);
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) || expected != len) {
+        std::cout << "Error - calibration cache " << yellow << path.string() << res << " is corrupt, ignoring." << std::endl;
+        return Calibration();
+    }
+
+    // The masters are views straight onto the mapped planes
+    char* data = mapped.data + map_aligned(sizeof(CacheHeader));
+    const auto plane = [&](const int type, const size_t bytes) {
+        cv::Mat m(header.rows, header.cols, type, data);
+        data += map_aligned(bytes);
+        return m;
+    };
+    const int type = CV_32FC(header.channels);
+    const size_t bytes = pixels * header.channels * sizeof(float);
+    if (header.planes & cache_bias) cal.bias = plane(type, bytes);
+    if (header.planes & cache_dark) cal.dark = plane(type, bytes);
+    if (header.planes & cache_flat) cal.flat = plane(type, bytes);
+    if (header.planes & cache_hot) cal.hot = plane(CV_8UC1, pixels);
+    return cal;
+}
+
+cv::Mat calibrate(const cv::Mat &light, const Calibration &cal, const double exposure) {
+    Span span("calibrate");
+    const int nb = light.channels();
+    for (const auto *m : {&cal.bias, &cal.dark, &cal.flat}) {
+        if (!m->empty() && (m->size() != light.size() || m->channels() != nb)) {
+            std::cout << "Error - calibration masters of shape " << m->rows << "x" << m->cols << "x" << m->channels()
+                      << " do not match light of shape " << light.rows << "x" << light.cols << "x" << nb << std::endl;
+            return cv::Mat();
+        }
+    }
+    const bool repair = !cal.hot.empty() && cal.hot.size() == light.size();
+    const float scale = exposure > 0 && cal.key.exposure > 0 ? exposure / cal.key.exposure : 1;
+    cv::Mat out(light.rows, light.cols, light.type());
+
+    // Calibrated value of element {e} (column * channels + channel) of row {r}
+    const auto value = [&](const int r, const int e) {
+        float v = light.ptr(r)[e];
+        if (!cal.bias.empty()) v -= cal.bias.ptr<float>(r)[e];
+        if (!cal.dark.empty()) v -= scale * cal.dark.ptr<float>(r)[e];
+        if (!cal.flat.empty()) v /= std::max(cal.flat.ptr<float>(r)[e], min_flat);
+        return v;
+    };
+
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < light.rows; r ++) {
+        const uchar* in = light.ptr(r);
+        const float* b = cal.bias.empty() ? nullptr : cal.bias.ptr<float>(r);
+        const float* d = cal.dark.empty() ? nullptr : cal.dark.ptr<float>(r);
+        const float* f = cal.flat.empty() ? nullptr : cal.flat.ptr<float>(r);
+        const uchar* h = repair ? cal.hot.ptr(r) : nullptr;
+        uchar* o = out.ptr(r);
+        for (int c = 0; c < light.cols; c ++) {
+            if (h && h[c]) {
+                // Hot pixels take the mean of their calibrated neighbours which are not hot themselves
+                for (int k = 0; k < nb; k ++) {
+                    float sum = 0;
+                    int n = 0;
+                    for (int rr = std::max(r - 1, 0); rr <= std::min(r + 1, light.rows - 1); rr ++) {
+                        for (int cc = std::max(c - 1, 0); cc <= std::min(c + 1, light.cols - 1); cc ++) {
+                            if (cal.hot.ptr(rr)[cc]) continue;
+                            sum += value(rr, cc * nb + k);
+                            n ++;
+                        }
+                    }
+                    o[c * nb + k] = cv::saturate_cast<uchar>(n ? sum / n : value(r, c * nb + k));
+                }
+                continue;
+            }
+            for (int k = 0; k < nb; k ++) {
+                const int e = c * nb + k;
+                float v = in[e];
+                if (b) v -= b[e];
+                if (d) v -= scale * d[e];
+                if (f) v /= std::max(f[e], min_flat);
+                o[e] = cv::saturate_cast<uchar>(v);
+            }
+        }
+    }
+    return out;
+}
+
+void calibrate_files(const std::vector<std::string> &files, const Calibration &cal, const double exposure,
+                     const std::string &suffix) {
+    // Parallel over frames, the kernel itself runs serially within each frame's thread
+    std::cout << "Calibrating..." << std::endl;
+    Progress progress(files.size());
+#pragma omp parallel for schedule(dynamic)
+    for (size_t ii = 0; ii < files.size(); ii ++) {
+        const cv::Mat light = read_image(files[ii]);
+        if (!light.empty()) {
+            const cv::Mat out = calibrate(light, cal, exposure);
+            fs::path path(files[ii]);
+            if (!out.empty()) write_image(path.replace_filename(path.stem().string()+suffix+path.extension().string()).string(), out);
+        }
+        progress.tick();
+    }
+    progress.finish();
+}
@@ -0,0 +1,70 @@
+/*
+ * calibrate.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Calibration masters (bias, dark, flat and hot pixel map)
+ * built once by robust stacking, cached on disk as float
+ * planes which are memory mapped on reuse, and applied to
+ * light frames in a single fused kernel.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "reduce.h"
+
+// Capture conditions the masters are valid for, the darks' exposure also scales the dark current
+struct CalibrationKey {
+    double exposure = 0;        // Seconds
+    int iso = 0;
+    double temperature = 0;     // Celsius
+
+    std::string name() const;   // Cache file stem, e.g. "e30_iso800_t12.5"
+};
+
+struct Calibration {
+    CalibrationKey key;
+    cv::Mat bias;               // CV_32FC(n) master bias
+    cv::Mat dark;               // CV_32FC(n) bias subtracted master dark for {key.exposure}
+    cv::Mat flat;               // CV_32FC(n) bias subtracted master flat normalized to a mean of 1
+    cv::Mat hot;                // CV_8UC1, non-zero at hot pixels
+
+    bool empty() const { return bias.empty() && dark.empty() && flat.empty(); }
+
+    // Keeps the file mapping alive for masters loaded from the cache
+    std::shared_ptr<void> mapping;
+};
+
+// Robust (by default sigma clipped) float stack of the frames in {files}
+cv::Mat master_frame(const std::vector<std::string> &files, const Reduction mode = Reduction::sigma_clip,
+                     const double kappa = 3.0, const size_t iters = 5);
+
+// Build the masters from whichever of the three frame lists are given
+Calibration build_masters(const std::vector<std::string> &bias, const std::vector<std::string> &darks,
+                          const std::vector<std::string> &flats, const CalibrationKey &key,
+                          const double kappa = 3.0, const double z = 5.0);
+
+// Pixels of the master {dark} more than {z} standard deviations above the mean in any channel
+cv::Mat hot_pixel_map(const cv::Mat &dark, const double z = 5.0);
+
+// Masters cache, one file per key under {dir}. [load_masters] returns an empty calibration if
+// there is no cached entry for {key}, otherwise the masters are views onto the mapped file.
+bool save_masters(const Calibration &cal, const std::string &dir);
+Calibration load_masters(const CalibrationKey &key, const std::string &dir);
+
+// Bias subtraction, dark subtraction scaled to {exposure}, flat division and hot pixel repair of
+// the 8-bit {light} in one pass, returning the calibrated frame in the light's type
+cv::Mat calibrate(const cv::Mat &light, const Calibration &cal, const double exposure);
+
+// Calibrate each of {files} and write it alongside the input with {suffix} added to the stem,
+// each frame is read and written exactly once
+void calibrate_files(const std::vector<std::string> &files, const Calibration &cal, const double exposure,
+                     const std::string &suffix = "_cal");
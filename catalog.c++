@@ -0,0 +1,219 @@
+/*
+ * catalog.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the parallel union-find component
+ * labeller and star catalog extraction.
+ *
+ */
+
+#include "catalog.h"
+#include "enhance.h"
+
+// Root of {p} in the forest {parent}, halving the path on the way up
+static inline int32_t _find(int32_t* parent, int32_t p) {
+    while (parent[p] != p) {
+        parent[p] = parent[parent[p]];
+        p = parent[p];
+    }
+    return p;
+}
+// As above but without modifying {parent}, for concurrent readers
+static inline int32_t _root(const int32_t* parent, int32_t p) {
+    while (parent[p] != p) p = parent[p];
+    return p;
+}
+// Merge the trees of {a} and {b}, the smaller index becomes the root so that each component's
+// root is its first pixel in raster order
+static inline void _unite(int32_t* parent, const int32_t a, const int32_t b) {
+    const int32_t ra = _find(parent, a);
+    const int32_t rb = _find(parent, b);
+    if (ra < rb) parent[rb] = ra;
+    else if (rb < ra) parent[ra] = rb;
+}
+// Join the foreground pixel at ({r}, {c}) with its foreground neighbours in row {r} - 1
+static inline void _unite_above(int32_t* parent, const cv::Mat &mask, const int r, const int c) {
+    const uchar* above = mask.ptr(r - 1);
+    const int32_t idx = r * mask.cols + c;
+    if (c > 0 && above[c - 1]) _unite(parent, idx - mask.cols - 1, idx);
+    if (above[c]) _unite(parent, idx - mask.cols, idx);
+    if (c < mask.cols - 1 && above[c + 1]) _unite(parent, idx - mask.cols + 1, idx);
+}
+
+void StarCatalog::resize(const size_t n) {
+    x.assign(n, 0);
+    y.assign(n, 0);
+    flux.assign(n, 0);
+    area.assign(n, 0);
+    left.assign(n, std::numeric_limits<int>::max());
+    right.assign(n, -1);
+    top.assign(n, std::numeric_limits<int>::max());
+    bottom.assign(n, -1);
+    peak.assign(n, 0);
+}
+
+std::vector<size_t> StarCatalog::largest(const size_t n) const {
+    std::vector<size_t> order(size());
+    std::iota(order.begin(), order.end(), 0);
+    const size_t k = std::min(n, order.size());
+    std::partial_sort(order.begin(), order.begin() + k, order.end(), [this](const size_t l, const size_t r) {
+        return area[l] != area[r] ? area[l] > area[r] : flux[l] > flux[r];
+    });
+    order.resize(k);
+    return order;
+}
+
+cv::Mat label_components(const cv::Mat &mask, size_t &count) {
+    // Each strip of rows is labelled independently with the pixel indices themselves as the
+    // union-find forest, the strips are then stitched along their shared edges and the roots
+    // renumbered 1 to {count} in raster order.
+    count = 0;
+    if (mask.empty() || mask.type() != CV_8UC1) {
+        std::cout << "Error - component labelling requires a single channel 8-bit mask." << std::endl;
+        return cv::Mat();
+    }
+    if (mask.total() >= (size_t)std::numeric_limits<int32_t>::max()) {
+        std::cout << "Error - mask is too large to label (" << mask.total() << " pixels)." << std::endl;
+        return cv::Mat();
+    }
+    const int rows = mask.rows, cols = mask.cols;
+    std::vector<int32_t> forest(mask.total());
+    int32_t* parent = forest.data();
+
+    const int nstrips = std::max(1, std::min(omp_get_max_threads(), rows));
+    const int strip = (rows + nstrips - 1) / nstrips;
+
+#pragma omp parallel for schedule(static)
+    for (int s = 0; s < nstrips; s ++) {
+        const int r0 = s * strip;
+        for (int r = r0; r < std::min(rows, r0 + strip); r ++) {
+            const uchar* pixel = mask.ptr(r);
+            for (int c = 0; c < cols; c ++) {
+                const int32_t idx = r * cols + c;
+                if (!pixel[c]) {
+                    parent[idx] = -1;
+                    continue;
+                }
+                parent[idx] = idx;
+                if (c > 0 && pixel[c - 1]) _unite(parent, idx - 1, idx);
+                if (r > r0) _unite_above(parent, mask, r, c);
+            }
+        }
+    }
+
+    // Stitch the first row of each strip to the last row of the one before
+    for (int s = 1; s < nstrips && s * strip < rows; s ++) {
+        const uchar* pixel = mask.ptr(s * strip);
+        for (int c = 0; c < cols; c ++) if (pixel[c]) _unite_above(parent, mask, s * strip, c);
+    }
+
+    // Resolve every pixel to its root, then count the roots in each strip so that they can
+    // be numbered in raster order without another serial pass
+    cv::Mat labels(rows, cols, CV_32S);
+    std::vector<size_t> first(nstrips + 1, 0);
+#pragma omp parallel for schedule(static)
+    for (int s = 0; s < nstrips; s ++) {
+        size_t roots = 0;
+        for (int r = s * strip; r < std::min(rows, (s + 1) * strip); r ++) {
+            int32_t* label = labels.ptr<int32_t>(r);
+            for (int c = 0; c < cols; c ++) {
+                const int32_t idx = r * cols + c;
+                label[c] = parent[idx] < 0 ? -1 : _root(parent, idx);
+                roots += label[c] == idx;
+            }
+        }
+        first[s + 1] = roots;
+    }
+    for (int s = 0; s < nstrips; s ++) first[s + 1] += first[s];
+    count = first[nstrips];
+
+    // Roots are only read back through {labels} from here on, so the forest can hold the new numbers
+#pragma omp parallel for schedule(static)
+    for (int s = 0; s < nstrips; s ++) {
+        int32_t id = first[s];
+        for (int r = s * strip; r < std::min(rows, (s + 1) * strip); r ++) {
+            const int32_t* label = labels.ptr<int32_t>(r);
+            for (int c = 0; c < cols; c ++) if (label[c] == r * cols + c) parent[label[c]] = ++id;
+        }
+    }
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < rows; r ++) {
+        int32_t* label = labels.ptr<int32_t>(r);
+        for (int c = 0; c < cols; c ++) label[c] = label[c] < 0 ? 0 : parent[label[c]];
+    }
+    return labels;
+}
+
+StarCatalog star_catalog(const cv::Mat &labels, const size_t count, const cv::Mat &image) {
+    // Every thread accumulates a private catalog over its rows, with {x} and {y} holding the
+    // weighted coordinate sums, and the partial catalogs are then merged component by component
+    StarCatalog catalog;
+    catalog.resize(count);
+    if (!count) return catalog;
+    if (!image.empty() && (image.type() != CV_8UC1 || image.size() != labels.size())) {
+        std::cout << "Error - star catalog image must be single channel 8-bit and match the labels." << std::endl;
+        catalog.resize(0);
+        return catalog;
+    }
+
+    std::vector<StarCatalog> parts(omp_get_max_threads());
+#pragma omp parallel
+    {
+        StarCatalog &part = parts[omp_get_thread_num()];
+        part.resize(count);
+#pragma omp for schedule(static)
+        for (int r = 0; r < labels.rows; r ++) {
+            const int32_t* label = labels.ptr<int32_t>(r);
+            const uchar* pixel = image.empty() ? nullptr : image.ptr(r);
+            for (int c = 0; c < labels.cols; c ++) {
+                if (!label[c]) continue;
+                const size_t k = label[c] - 1;
+                const uchar v = pixel ? pixel[c] : 1;
+                part.area[k] ++;
+                part.flux[k] += v;
+                part.x[k] += v * c;
+                part.y[k] += v * r;
+                part.left[k] = std::min(part.left[k], c);
+                part.right[k] = std::max(part.right[k], c);
+                part.top[k] = std::min(part.top[k], r);
+                part.bottom[k] = std::max(part.bottom[k], r);
+                part.peak[k] = std::max(part.peak[k], v);
+            }
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < count; k ++) {
+        for (const auto &part : parts) {
+            if (!part.area[k]) continue;
+            catalog.area[k] += part.area[k];
+            catalog.flux[k] += part.flux[k];
+            catalog.x[k] += part.x[k];
+            catalog.y[k] += part.y[k];
+            catalog.left[k] = std::min(catalog.left[k], part.left[k]);
+            catalog.right[k] = std::max(catalog.right[k], part.right[k]);
+            catalog.top[k] = std::min(catalog.top[k], part.top[k]);
+            catalog.bottom[k] = std::max(catalog.bottom[k], part.bottom[k]);
+            catalog.peak[k] = std::max(catalog.peak[k], part.peak[k]);
+        }
+        // A component with no signal in {image} falls back to the centre of its bounding box
+        if (catalog.flux[k]) {
+            catalog.x[k] /= catalog.flux[k];
+            catalog.y[k] /= catalog.flux[k];
+        }
+        else {
+            catalog.x[k] = (catalog.left[k] + catalog.right[k]) / 2.;
+            catalog.y[k] = (catalog.top[k] + catalog.bottom[k]) / 2.;
+        }
+    }
+    return catalog;
+}
+
+StarCatalog star_catalog(const cv::Mat &mask, const cv::Mat &image) {
+    size_t count;
+    const cv::Mat labels = label_components(mask, count);
+    if (labels.empty()) return StarCatalog();
+    return star_catalog(labels, count, image);
+}
@@ -0,0 +1,44 @@
+/*
+ * catalog.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Connected-components labelling of star masks by union-find
+ * over row strips, and a structure-of-arrays catalog of the
+ * components' centroid, flux, area, bounding box and peak.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// One entry per connected component, indexed by label - 1
+struct StarCatalog {
+    std::vector<double> x, y;               // Centroid weighted by pixel value
+    std::vector<double> flux;               // Sum of pixel values
+    std::vector<uint32_t> area;             // Pixel count
+    std::vector<int> left, right;           // Inclusive bounding box columns
+    std::vector<int> top, bottom;           // Inclusive bounding box rows
+    std::vector<uchar> peak;                // Largest pixel value
+
+    size_t size() const { return area.size(); }
+    void resize(const size_t n);
+
+    // Indices of the (at most) {n} largest components, by area and then flux
+    std::vector<size_t> largest(const size_t n) const;
+};
+
+// 8-connected labelling of the non-zero pixels of the single channel CV_8U {mask}. Returns a
+// CV_32S image holding 0 for background and 1 to {count} for each component, numbered in
+// raster order of their first pixel.
+cv::Mat label_components(const cv::Mat &mask, size_t &count);
+
+// Catalog of the components of {labels}. Fluxes and centroids are measured on the single
+// channel CV_8U {image}, or treat every component pixel as 1 if {image} is empty.
+StarCatalog star_catalog(const cv::Mat &labels, const size_t count, const cv::Mat &image = cv::Mat());
+StarCatalog star_catalog(const cv::Mat &mask, const cv::Mat &image = cv::Mat());
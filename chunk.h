@@ -27,6 +27,7 @@ Pos operator/(const double &s, const Pos &p);
 Pos operator+(const Pos &l, const Pos &r);
 
 bool operator==(const Pos &l, const Pos &r);
+bool operator<(const Pos &l, const Pos &r);
 
 // Struct to store vertical and horizontal extent
 struct Extent {
@@ -12,7 +12,13 @@
  *
  * Usage: 
  * 
- *    coadd [-i|--images] <files> [-h|--scrub-hot-pixels]
+ *    coadd [-i|--images] <files> [-h|--scrub-hot-pixels] [--mode average|median|sigma|winsor]
+ *          [-k|--kappa] <kappa> [--iterations] <n> [-s|--stream] [-m|--memory] <MB>
+ *          [--scratch <dir>] [--partial <file> [--sketch <k>]] [--cache <dir>]
+ *
+ * With --partial the images are accumulated into a partial
+ * stack written to <file> instead of coadded, for the merge
+ * routine to combine with the partials of other shards.
  *
  */
  
@@ -21,7 +27,15 @@
 int main(int argn, char** argv) {
 	std::vector<std::string> files;
 	bool pixel_scrubbing;
+	bool stream;
+	size_t memory;
+	size_t iters;
+	double kappa;
 	std::string mode;
+	std::string partial;
+	size_t sketch;
+	std::string cache;
+	std::string scratch;
 
 	po::options_description description("Usage");
 
@@ -29,7 +43,21 @@ int main(int argn, char** argv) {
 		description.add_options()
 			("images,i", po::value<std::vector<std::string> >()->multitoken(), "The images to coadd,")
 			("scrub-hot-pixels,h", po::bool_switch()->default_value(false), "Scrub the hot pixels out of each image")
-			("mode", po::value<std::string>(&mode)->default_value("average"), "The accumulation mode, options are average or median.")
+			("mode", po::value<std::string>(&mode)->default_value("average"), "The accumulation mode, options are average, median, sigma"
+				" (kappa-sigma clipped mean) or winsor (winsorized mean).")
+			("kappa,k", po::value<double>(&kappa)->default_value(2.5), "The rejection threshold in standard deviations for sigma and winsor.")
+			("iterations", po::value<size_t>(&iters)->default_value(5), "The maximum number of rejection iterations for sigma and winsor.")
+			("stream,s", po::bool_switch()->default_value(false), "Read the images as they are needed instead of all at once,"
+				" for stacks which do not fit in memory. In every mode, images whose shape does not match the first are skipped.")
+			("memory,m", po::value<size_t>(&memory)->default_value(4096), "The memory budget in MB for image data when streaming.")
+			("scratch", po::value<std::string>(&scratch)->default_value(""), "Directory for the scratch stack of the streamed median, sigma"
+				" and winsor modes, which needs room for every decoded frame. Defaults to the system temporary directory.")
+			("partial", po::value<std::string>(&partial), "Write a partial stack of the images to this file instead of coadding,"
+				" see the merge routine.")
+			("sketch", po::value<size_t>(&sketch)->default_value(4), "The number of extreme values kept per pixel in the partial,"
+				" for clipping when merged.")
+			("cache", po::value<std::string>(&cache), "Directory of decoded frame caches, the images are decoded once and mapped on"
+				" later runs over the same files.")
 		;
 	}
 	catch (...) {
@@ -42,18 +70,51 @@ int main(int argn, char** argv) {
 	po::notify(vm);
 
 	pixel_scrubbing = vm["scrub-hot-pixels"].as<bool>();
+	stream = vm["stream"].as<bool>();
 	if (vm.count("images")) files = vm["images"].as<std::vector<std::string> >();
 	else {
 		std::cout << "Error - must specify images to coadd" << std::endl;
 		exit(2);
 	}
 
-	
-	std::vector<cv::Mat> images = read_images(files);
-	if (pixel_scrubbing) images = scrub_hot_pixels(images);
+	if (mode != "average" && mode != "median" && mode != "sigma" && mode != "winsor") {
+		std::cout << "Error - unknown mode " << yellow << mode << res << std::endl;
+		exit(3);
+	}
+
+	if (vm.count("partial")) {
+		if (pixel_scrubbing) std::cout << yellow << "Warning" << res << " - hot pixel scrubbing needs the whole stack, ignored with --partial." << std::endl;
+		if (!vm["mode"].defaulted()) std::cout << yellow << "Warning" << res << " - the mode is chosen when merging, ignored with --partial." << std::endl;
+		const PartialStack stack = stream_partial(files, memory << 20, sketch);
+		if (stack.empty() || !save_partial(stack, partial)) exit(4);
+		return 0;
+	}
 
 	cv::Mat output;
-	if (mode == "average") output = coadd(images);
-	else if (mode == "median") output = median_coadd(images);
-	cv::imwrite("./coadded.tif", output);
+	if (stream && !vm.count("cache")) {
+		if (pixel_scrubbing) std::cout << yellow << "Warning" << res << " - hot pixel scrubbing needs the whole stack, ignored with --stream." << std::endl;
+		if (mode == "average") output = stream_coadd(files, memory << 20);
+		else output = stream_reduce(files, memory << 20, to_reduction(mode), kappa, iters, scratch);
+		if (output.empty()) exit(5);
+	}
+	else {
+		// Cached frames are mapped rather than held in memory, so they never need --stream. The
+		// stack keeps the mapping alive for as long as the images are used.
+		FrameStack stack;
+		if (vm.count("cache")) {
+			stack = cached_frames(files, cache);
+			if (stack.empty()) std::cout << yellow << "Warning" << res << " - could not use the frame cache, decoding the images instead." << std::endl;
+		}
+		std::vector<cv::Mat> images = !stack.empty() ? stack.valid() : read_images(files);
+		if (pixel_scrubbing) images = scrub_hot_pixels(images);
+
+		if (mode == "average") output = coadd(images);
+		else if (mode == "median") output = median_coadd(images);
+		else output = reduce_stack(images, to_reduction(mode), kappa, iters);
+	}
+	if (output.empty()) {
+		std::cout << "Error - no images could be coadded." << std::endl;
+		exit(6);
+	}
+	write_image("./coadded.tif", output);
 }
@@ -19,7 +19,7 @@ double median(std::vector<double> &v) {
     else {
     	const size_t size = v.size();
     	const size_t mid = size / 2;
-    	std::nth_element(v.begin(), v.end() + size / 2, v.end());
+    	std::nth_element(v.begin(), v.begin() + mid, v.end());
 
         return size % 2 ? v[mid] : (v[mid] + *(std::max_element(v.begin(), v.begin() + mid))) / 2.0;
     }
@@ -8,6 +8,12 @@
  * Also useful in removing skyglow from frames taken in 
  * Moonlight or near twilight. 
  *
+ * Usage:
+ *
+ *    depollute [-i|--images] <files> [-s|--scale] <pixels> [-z|--z-score] <z>
+ *              [-d|--detection] gaussian|brightness [-o|--order] <order>
+ *              [--surface] polynomial|spline
+ *
  */
 
 #include "enhance.h"
@@ -16,9 +22,12 @@ int main(int argn, char** argv) {
     std::cout << res;
     std::vector<std::string> files;
     std::string _mode;
-    findBy mode;
+    std::string _surface;
+    FindBy mode = FindBy::gaussian;
+    Surface surface;
     size_t scale;
     size_t z;
+    int order;
 
    	po::options_description description("Usage");
 
@@ -28,6 +37,9 @@ int main(int argn, char** argv) {
 			("scale,s", po::value<size_t>(&scale)->default_value(10), "The spatial scale of the depollution model elements.")
 			("z-score,z", po::value<size_t>(&z)->default_value(8), "The z-score threshold for star detection.")
 			("detection,d", po::value<std::string>(&_mode)->default_value("gaussian"), "The star detection mode, options are \"gaussian\" or \"brightness\"")
+			("order,o", po::value<int>(&order)->default_value(1), "The order of the polynomial fitted to each model element [0-6].")
+			("surface", po::value<std::string>(&_surface)->default_value("polynomial"), "How the model elements are joined, options are"
+				" \"polynomial\" (blended polynomial fits) or \"spline\" (bicubic spline through the element centers).")
 		;
 	}
 	catch (...) {
@@ -50,14 +62,23 @@ int main(int argn, char** argv) {
 		std::cout << "Error - must specify input images." << std::endl;
 		exit(2);
 	}
-    if (_mode == "gaussian") mode = findBy::gaussian;
-    else if (_mode == "brightness") mode = findBy::brightness;
-
-    std::vector<cv::Mat3b> images = read_images(files);
-	for (auto &image : images) {
-        cv::Mat model = depollute(image, scale, z, mode);
-        cv::imwrite("model.tif", model);
-        cv::imwrite("depolluted.tif", image);
+    if (_mode == "gaussian") mode = FindBy::gaussian;
+    else if (_mode == "brightness") mode = FindBy::brightness;
+    else {
+        std::cout << "Error - unrecognized detection mode " << yellow << _mode << res << std::endl;
+        exit(3);
+    }
+    if (!to_surface(_surface, surface)) exit(3);
+
+    // Read one image at a time so that whole nights can be processed in a single call
+	for (const auto &file : files) {
+        cv::Mat image = read_image(file);
+        if (image.empty()) continue;
+        cv::Mat model = depollute(image, scale, z, mode, order, surface);
+
+        fs::path path(file);
+        write_image(fs::path(path).replace_filename(path.stem().string()+"_model.tif").string(), model);
+        write_image(fs::path(path).replace_filename(path.stem().string()+"_depolluted.tif").string(), image);
 	}
 }
 
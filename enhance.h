@@ -15,16 +15,34 @@
 #include <chrono>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <experimental/filesystem>
+#include <fstream>
+#include <functional>
 #include <future>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <mutex>
+#include <numeric>
 #include <random>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <valarray>
 
+// POSIX
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+// OpenMP
+#include <omp.h>
+
 // ffmpeg
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -57,6 +75,21 @@ class Blob; // Forward declared for use in processing.h
 #include "processing.h"
 #include "compute.h"
 #include "operators.h"
+#include "reduce.h"
+#include "localstats.h"
+#include "skymodel.h"
+#include "registration.h"
+#include "pool.h"
+#include "catalog.h"
+#include "video.h"
+#include "trails.h"
+#include "mapfile.h"
+#include "calibrate.h"
+#include "synthetic.h"
+#include "telemetry.h"
+#include "stages.h"
+#include "partial.h"
+#include "framecache.h"
 
 // Other (some enhance headers depend on these declarations)
 #include "blob.h"
@@ -85,7 +118,11 @@ enum class FindBy {gaussian, brightness};
 // File IO
 //    Images
 cv::Mat read_image(std::string file);                                          // Read the single image specified by {file}
-std::vector<cv::Mat> read_images(std::vector<std::string> files);              // Read the images in the filelist {files}
+bool write_image(const std::string &file, const cv::Mat &image);               // Write {image} to {file}, false on failure
+std::vector<cv::Mat> read_images(std::vector<std::string> files);              // Read the images in the filelist {files} in order,
+                                                                               // skipping any which fail to open
+std::vector<cv::Mat> read_batch(const std::vector<std::string> &files,         // Read {files}[{start}, {end}) in order, leaving
+                                const size_t start, const size_t end);         // an empty [Mat] for any file which fails to open
 
 //     Videos
 std::vector<cv::Mat> extract_frames(std::vector<std::string> files);           // Extract the frames from a video file into frames in a 
@@ -97,21 +134,22 @@ cv::Mat4b advanced_coadd(const std::vector<cv::Mat> images,                    /
                                  double threshold = 0.3);                      // below {max_intensity}*{threshold}
 cv::Mat star_trail(const std::vector<cv::Mat> images, const uint threshold=0); // Find star trails from {images} and return a composite with
                                                                                // star trails stacked on coadded image
-cv::Mat depollute(cv::Mat &images, const size_t size = 50, 
-                  const size_t z=8, const FindBy find = FindBy::gaussian);
+cv::Mat star_trail(FrameSource &source, const uint threshold=0,               // As above streaming the frames of {source} in one pass,
+                   const size_t every=0,                                       // passing the running composite to {emit} every {every}
+                   const std::function<void(const cv::Mat&)> &emit=nullptr);  // frames
+cv::Mat depollute(cv::Mat &image, const size_t size = 50,                      // Model and subtract the sky background of {image}
+                  const size_t z=8, const FindBy find = FindBy::gaussian,      // from polynomial fits over tiles of {size} pixels
+                  const int order = 1, const Surface surface = Surface::polynomial);
 
 // Star position retrieval etc
 cv::Mat brightness_find(const cv::Mat &_image, const size_t z=8);
 cv::Mat brightness_find_legacy(const cv::Mat &image, uchar max_intensisty,     // Finds stars in {image} based on relative brightness, 
                      int nn = 0, double star_threshold = 0.995);               // returning a [Mat] mask of stars |LEGACY|
-cv::Mat gaussian_find(const cv::Mat &_image, long w, size_t z=8);              // Find stars by 2D Gaussian fitting
+cv::Mat gaussian_find(const cv::Mat &_image, long w, size_t z=8);              // Find stars by local mean and standard deviation
 Chunk gaussian_estimate(const uchar* pixel, const size_t &cols, const Extent &e);
 std::vector<std::pair<double, double>> star_positions(const cv::Mat &image, 
                                                       const size_t &n = 100);
 
-Eigen::MatrixXd depollute_region(cv::Mat &image, const cv::Mat &stars, const long &r, 
-                                 const long &c, const int &b, const size_t &size);
-
 // Intensity assessment
 uchar find_max(std::vector<cv::Mat> images);                                    // Find the brightest pixel in {images}
 int brightness(const cv::Vec3b& input);                                         // Find the brightness value of the given 3 channel pixel
@@ -0,0 +1,188 @@
+/*
+ * framecache.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the decoded frame cache and its store
+ * format.
+ *
+ */
+
+#include "framecache.h"
+#include "enhance.h"
+
+// Layout of a store - this header padded to {map_align} bytes, then the pixels of each frame
+// padded to {map_align} bytes, then the index, one record per file each followed by its path
+struct StoreHeader {
+    char magic[8];
+    uint64_t count;
+    uint64_t index_offset, index_bytes;
+};
+struct StoreRecord {
+    int64_t mtime, size;
+    int32_t rows, cols, type, path_bytes;
+    uint64_t offset;                    // Of the pixels from the start of the store
+    double mean[4], stddev[4];
+};
+const char store_magic[8] = {'E', 'N', 'H', 'F', 'R', 'M', '0', '1'};
+
+// Path, modification time and size of {file} as they are now
+static FrameEntry _entry(const std::string &file) {
+    FrameEntry entry;
+    entry.path = fs::absolute(fs::path(file)).string();
+    struct stat st;
+    if (stat(file.c_str(), &st) == 0) {
+        entry.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        entry.size = st.st_size;
+    }
+    return entry;
+}
+
+std::vector<cv::Mat> FrameStack::valid() const {
+    std::vector<cv::Mat> out;
+    out.reserve(frames.size());
+    for (const auto &f : frames) if (!f.empty()) out.push_back(f);
+    return out;
+}
+
+std::string frame_store(const std::vector<std::string> &files, const std::string &dir) {
+    // FNV-1a over the absolute paths, so the same files named differently share a store
+    uint64_t hash = 14695981039346656037ull;
+    for (const auto &file : files) {
+        for (const char c : fs::absolute(fs::path(file)).string() + '\0') {
+            hash ^= (uchar)c;
+            hash *= 1099511628211ull;
+        }
+    }
+    std::stringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << hash << ".frames";
+    return (fs::path(dir) / name.str()).string();
+}
+
+static bool _build_store(const std::vector<std::string> &files, const std::string &path) {
+    std::vector<StoreRecord> records(files.size());
+    std::vector<FrameEntry> entries(files.size());
+    const bool written = atomic_write(path, [&](std::ofstream &out) {
+        StoreHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, store_magic, sizeof(store_magic));
+        header.count = files.size();
+        write_aligned(out, &header, sizeof(header));
+
+        // Decoded in parallel a batch at a time, so only one batch is ever held in memory
+        size_t offset = map_aligned(sizeof(StoreHeader));
+        const size_t batch = 2 * std::max(max_threads, 1);
+        std::cout << "Caching decoded frames..." << std::endl;
+        Progress progress(files.size());
+        for (size_t start = 0; start < files.size() && out; start += batch) {
+            const size_t end = std::min(start + batch, files.size());
+            const std::vector<cv::Mat> frames = read_batch(files, start, end);
+            for (size_t ii = start; ii < end; ii ++) {
+                const cv::Mat &frame = frames[ii - start];
+                FrameEntry &entry = entries[ii];
+                StoreRecord &record = records[ii];
+                std::memset(&record, 0, sizeof(record));
+                entry = _entry(files[ii]);
+                record.mtime = entry.mtime;
+                record.size = entry.size;
+                record.path_bytes = entry.path.size();
+                if (frame.empty() || frame.channels() > 4) continue;
+
+                cv::Scalar mean, stddev;
+                cv::meanStdDev(frame, mean, stddev);
+                record.rows = frame.rows;
+                record.cols = frame.cols;
+                record.type = frame.type();
+                record.offset = offset;
+                for (int ch = 0; ch < 4; ch ++) {
+                    record.mean[ch] = mean[ch];
+                    record.stddev[ch] = stddev[ch];
+                }
+                write_plane(out, frame);
+                offset += map_aligned(frame.total() * frame.elemSize());
+            }
+            progress.tick(end - start);
+        }
+        progress.finish();
+
+        header.index_offset = offset;
+        for (size_t ii = 0; ii < files.size(); ii ++) {
+            out.write((const char*)&records[ii], sizeof(StoreRecord));
+            out.write(entries[ii].path.data(), entries[ii].path.size());
+            header.index_bytes += sizeof(StoreRecord) + entries[ii].path.size();
+        }
+        out.seekp(0);
+        out.write((const char*)&header, sizeof(header));
+    }, "frame cache");
+    if (written) std::cout << "Cached " << files.size() << " frames in " << yellow << path << res << std::endl;
+    return written;
+}
+
+// The frames of the store at {path}, empty if it is missing, corrupt or any of {files} has changed
+static FrameStack _load_store(const std::vector<std::string> &files, const std::string &path) {
+    if (!fs::exists(fs::path(path))) return FrameStack();
+
+    // Frames modified in place never reach the cache
+    const MappedFile mapped = map_readonly_private(path, "frame cache", sizeof(StoreHeader));
+    if (mapped.empty()) return FrameStack();
+    const size_t len = mapped.size;
+
+    FrameStack stack;
+    stack.mapping = mapped.mapping;
+
+    const StoreHeader &header = *(const StoreHeader*)mapped.data;
+    if (std::memcmp(header.magic, store_magic, sizeof(store_magic)) || header.index_offset > len
+        || header.index_bytes > len - header.index_offset) {
+        std::cout << "Error - frame cache " << yellow << path << res << " is corrupt, ignoring." << std::endl;
+        return FrameStack();
+    }
+    if (header.count != files.size()) return FrameStack();
+
+    const char* base = mapped.data;
+    const char* record = base + header.index_offset;
+    const char* index_end = record + header.index_bytes;
+    stack.frames.resize(files.size());
+    stack.index.resize(files.size());
+    for (size_t ii = 0; ii < files.size(); ii ++) {
+        StoreRecord r;
+        if ((size_t)(index_end - record) < sizeof(r)) return FrameStack();
+        std::memcpy(&r, record, sizeof(r));
+        record += sizeof(r);
+        if (r.path_bytes < 0 || index_end - record < r.path_bytes) return FrameStack();
+
+        // Stale as soon as any file has been moved, modified or replaced
+        FrameEntry &entry = stack.index[ii];
+        entry = _entry(files[ii]);
+        if (entry.path.compare(0, std::string::npos, record, r.path_bytes) || entry.mtime != r.mtime || entry.size != r.size) {
+            return FrameStack();
+        }
+        record += r.path_bytes;
+        if (!r.rows) continue;
+
+        const cv::Mat frame(r.rows, r.cols, r.type, (void*)(base + r.offset));
+        if (r.offset % map_align || r.offset + frame.total() * frame.elemSize() > header.index_offset) {
+            std::cout << "Error - frame cache " << yellow << path << res << " is corrupt, ignoring." << std::endl;
+            return FrameStack();
+        }
+        entry.rows = r.rows;
+        entry.cols = r.cols;
+        entry.type = r.type;
+        std::copy(r.mean, r.mean + 4, entry.mean);
+        std::copy(r.stddev, r.stddev + 4, entry.stddev);
+        stack.frames[ii] = frame;
+    }
+    return stack;
+}
+
+FrameStack cached_frames(const std::vector<std::string> &files, const std::string &dir) {
+    if (files.empty()) return FrameStack();
+    const std::string path = frame_store(files, dir);
+    FrameStack stack = _load_store(files, path);
+    if (!stack.empty()) {
+        std::cout << "Using cached frames from " << yellow << path << res << std::endl;
+        return stack;
+    }
+    if (!_build_store(files, path)) return FrameStack();
+    return _load_store(files, path);
+}
@@ -0,0 +1,58 @@
+/*
+ * framecache.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Decoded frame cache. The frames of a session (a list of
+ * image files) are decoded once into a single store on disk,
+ * each frame's pixels aligned and laid out exactly as in a
+ * [cv::Mat], with an index of the file path, modification
+ * time, size, dimensions, type and statistics of each frame.
+ * Later runs over the same files map the store and hand out
+ * the frames as views onto it, so nothing is decoded or
+ * copied and the frames are paged in as they are touched.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+struct FrameEntry {
+    std::string path;
+    int64_t mtime = -1;         // Nanoseconds since the epoch, -1 if the file did not exist
+    int64_t size = -1;          // Bytes
+    int rows = 0, cols = 0, type = 0;
+    double mean[4] = {0};       // Per channel
+    double stddev[4] = {0};
+
+    bool empty() const { return !rows; }
+};
+
+struct FrameStack {
+    // In the order of the files given, with an empty frame for any file which could not be read so
+    // that {frames}[ii] is always the frame of {index}[ii].path
+    std::vector<cv::Mat> frames;
+    std::vector<FrameEntry> index;
+
+    bool empty() const { return frames.empty(); }
+
+    // The frames which could be read, still in order
+    std::vector<cv::Mat> valid() const;
+
+    // Keeps the file mapping alive for frames loaded from the cache
+    std::shared_ptr<void> mapping;
+};
+
+// Frames of {files} from the session store under {dir}, building (or rebuilding, if any of the
+// files has changed since) the store first if needed. The frames are views onto a private mapping
+// of the store, so writing to them never reaches the cache.
+FrameStack cached_frames(const std::vector<std::string> &files, const std::string &dir);
+
+// Store file of the session of {files} under {dir}, named for a hash of the absolute paths
+std::string frame_store(const std::vector<std::string> &files, const std::string &dir);
@@ -6,7 +6,8 @@
  *
  * Basic programmatic GIF artifact repair using
  * Gaussian blurring, selective Gaussian blurring, 
- * and unsharp masking.
+ * and unsharp masking. Frames are streamed so 
+ * videos of any length run in constant memory.
  */
 
 #include "enhance.h"
@@ -48,37 +49,35 @@ int main(int argn, char** argv) {
 	}
 	
     for (const auto &file : files) { 
-        // Read in and process the frames from {file}
-        std::vector<cv::Mat> frames;
-        cv::VideoCapture f(file);
-        double fps = f.get(cv::CAP_PROP_FPS);
-        int ex = static_cast<int>(f.get(cv::CAP_PROP_FOURCC));
-                
-        cv::Size size;
-        while (true) {
-            cv::Mat in, resized, blurred, out;
-            f >> in;
-            if (in.empty()) break;
+        // Frames are decoded, repaired in parallel and written back in order as they complete, 
+        // so only a few frames are held at once
+        VideoSource source({file});
+        cv::VideoWriter output;
+        fs::path path(file);
+        path.replace_extension(".mp4");
 
-            size = cv::Size(in.cols, in.rows) * scale;
-            
+        const auto repair = [&](const cv::Mat &in) {
+            cv::Mat resized, blurred, out;
+            const cv::Size size = cv::Size(in.cols, in.rows) * scale;
             cv::resize(in, resized, cv::Size(), 3.0, 3.0, cv::INTER_CUBIC);           // Scale up
             cv::GaussianBlur(resized, blurred, cv::Size(0, 0), resized.cols / blur);  // Apply Gaussian blur
             cv::GaussianBlur(blurred, blurred, cv::Size(0, 0), 2.0);                  // Apply median blur
             cv::resize(blurred, out, size, cv::INTER_CUBIC);                          // Scale back to original size (modified by {scale})
-
-            frames.push_back(out);
-        }
-        f.release();
-
-        // Write out the processed frames
-        cv::VideoWriter output;
-        fs::path path(file);
-        path.replace_extension(".mp4");
-        output.open(path.string(), cv::VideoWriter::fourcc('h', 'e', 'v', '1'), fps, size);
-        for (const auto &frame : frames) {
+            return out;
+        };
+        const auto write = [&](const cv::Mat &frame) {
+            if (!output.isOpened()) {
+                double fps = source.fps();
+                if (!std::isfinite(fps) || fps <= 0) {
+                    std::cout << yellow << "Warning" << res << " - unknown frame rate for " << yellow << file << res << ", using 25." << std::endl;
+                    fps = 25;
+                }
+                output.open(path.string(), cv::VideoWriter::fourcc('h', 'e', 'v', '1'), fps, frame.size());
+            }
             output << frame;
-        }
+        };
+        map_frames(source, repair, write, max_threads);
+        output.release();
     }
     return 0;
 }
@@ -0,0 +1,226 @@
+/*
+ * localstats.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the summed-area table statistics
+ * engine, histogram based whole-image statistics and the
+ * sliding window median background.
+ *
+ */
+
+#include "localstats.h"
+#include "enhance.h"
+
+LocalStats::LocalStats(const cv::Mat &image) : rows(image.rows), cols(image.cols), stride(image.cols + 1), 
+                                               sum((image.rows + 1) * stride, 0), sq((image.rows + 1) * stride, 0) {
+    // The tables have a leading row and column of zeros so that windows touching the edges
+    // need no special cases. Built as a three phase scan parallel over bands of rows: prefix 
+    // sums within each band, a serial carry of the band totals, then adding the carries.
+    const int nbands = std::max(1, std::min(omp_get_max_threads(), rows));
+    const int band = (rows + nbands - 1) / nbands;
+
+#pragma omp parallel for schedule(static)
+    for (int b = 0; b < nbands; b ++) {
+        for (int r = b * band; r < std::min(rows, (b + 1) * band); r ++) {
+            const uchar* pixel = image.ptr(r);
+            int64_t* s = sum.data() + (r + 1) * stride;
+            int64_t* q = sq.data() + (r + 1) * stride;
+            int64_t rs = 0, rq = 0;
+            for (int c = 0; c < cols; c ++) {
+                rs += pixel[c];
+                rq += pixel[c] * pixel[c];
+                s[c + 1] = rs;
+                q[c + 1] = rq;
+            }
+            if (r == b * band) continue;
+#pragma omp simd
+            for (size_t c = 1; c < stride; c ++) {
+                s[c] += s[c - stride];
+                q[c] += q[c - stride];
+            }
+        }
+    }
+
+    // Carry the last row of each band into the following bands
+    std::vector<int64_t> carry_s(nbands * stride, 0), carry_q(nbands * stride, 0);
+    for (int b = 1; b < nbands; b ++) {
+        const size_t last = std::min(rows, b * band) * stride;
+#pragma omp simd
+        for (size_t c = 0; c < stride; c ++) {
+            carry_s[b * stride + c] = carry_s[(b - 1) * stride + c] + sum[last + c];
+            carry_q[b * stride + c] = carry_q[(b - 1) * stride + c] + sq[last + c];
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int b = 1; b < nbands; b ++) {
+        for (int r = b * band; r < std::min(rows, (b + 1) * band); r ++) {
+            int64_t* s = sum.data() + (r + 1) * stride;
+            int64_t* q = sq.data() + (r + 1) * stride;
+#pragma omp simd
+            for (size_t c = 0; c < stride; c ++) {
+                s[c] += carry_s[b * stride + c];
+                q[c] += carry_q[b * stride + c];
+            }
+        }
+    }
+}
+
+Chunk LocalStats::window(const long r0, const long c0, const long r1, const long c1) const {
+    Chunk chunk(Extent {c0, c1, r0, r1});
+    int64_t n, s, q;
+    sums(r0, c0, r1, c1, n, s, q);
+    if (!n) return chunk;
+
+    chunk.n = n;
+    chunk.mean = s / (double)n;
+    chunk.var = std::max(q / (double)n - chunk.mean * chunk.mean, 0.0);
+    chunk.std = std::sqrt(chunk.var);
+    chunk.pos = Pos {(r0 + r1) / 2, (c0 + c1) / 2};
+    return chunk;
+}
+
+Chunk image_stats(const cv::Mat &image, const int channel) {
+    const int nb = image.channels();
+    const size_t len = channel < 0 ? image.cols * nb : image.cols;
+    const size_t step = channel < 0 ? 1 : nb;
+    const size_t offset = channel < 0 ? 0 : channel;
+
+    // Per-thread histograms, merged once at the end
+    uint64_t hist[256] = {0};
+#pragma omp parallel
+    {
+        uint64_t _hist[256] = {0};
+#pragma omp for schedule(static) nowait
+        for (int r = 0; r < image.rows; r ++) {
+            const uchar* pixel = image.ptr(r) + offset;
+            for (size_t e = 0; e < len; e ++, pixel += step) _hist[*pixel] ++;
+        }
+#pragma omp critical
+        for (int v = 0; v < 256; v ++) hist[v] += _hist[v];
+    }
+
+    Chunk chunk(Extent {0, image.cols, 0, image.rows});
+    double s = 0, q = 0;
+    for (int v = 0; v < 256; v ++) {
+        chunk.n += hist[v];
+        s += (double)v * hist[v];
+        q += (double)v * v * hist[v];
+    }
+    if (!chunk.n) return chunk;
+
+    chunk.mean = s / chunk.n;
+    chunk.var = std::max(q / chunk.n - chunk.mean * chunk.mean, 0.0);
+    chunk.std = std::sqrt(chunk.var);
+    chunk.median = histogram_median(hist, chunk.n);
+    return chunk;
+}
+
+double histogram_median(const uint64_t* hist, const uint64_t n) {
+    // Values of rank {lo} and {hi}, the same for odd {n}, averaged as in [median]
+    const uint64_t lo = (n - 1) / 2, hi = n / 2;
+    uint64_t count = 0;
+    int vlo = -1;
+    for (int v = 0; v < 256; v ++) {
+        count += hist[v];
+        if (vlo < 0 && count > lo) vlo = v;
+        if (count > hi) return (vlo + v) / 2.0;
+    }
+    return 0;
+}
+
+// As [histogram_median] for the running histograms of [median_background]
+static inline float _median(const uint32_t* hist, const uint32_t n) {
+    const uint32_t lo = (n - 1) / 2, hi = n / 2;
+    uint32_t count = 0;
+    int vlo = -1;
+    for (int v = 0; v < 256; v ++) {
+        count += hist[v];
+        if (vlo < 0 && count > lo) vlo = v;
+        if (count > hi) return (vlo + v) / 2.f;
+    }
+    return 0;
+}
+
+cv::Mat median_background(const cv::Mat &image, const size_t window, size_t step) {
+    if (image.empty() || image.depth() != CV_8U) {
+        std::cout << "Error - median background requires a non-empty 8-bit image." << std::endl;
+        return cv::Mat();
+    }
+    const int nb = image.channels();
+    if (!step) step = std::max<size_t>(1, window / 16);
+    const int gh = (image.rows + step - 1) / step, gw = (image.cols + step - 1) / step;
+    const int radius = std::max<size_t>(1, window / step / 2);
+
+    // Decimate to the grid of block means, all channels at once
+    cv::Mat grid(gh, gw, CV_8UC(nb));
+#pragma omp parallel for schedule(static)
+    for (int gr = 0; gr < gh; gr ++) {
+        const int r0 = gr * step, r1 = std::min<int>(r0 + step, image.rows);
+        std::vector<uint32_t> sums((size_t)gw * nb, 0);
+        for (int r = r0; r < r1; r ++) {
+            const uchar* pixel = image.ptr(r);
+            for (int gc = 0; gc < gw; gc ++) {
+                const int c1 = std::min<int>((gc + 1) * step, image.cols);
+                uint32_t* s = sums.data() + gc * nb;
+                for (int c = gc * step; c < c1; c ++) {
+                    for (int b = 0; b < nb; b ++) s[b] += pixel[c * nb + b];
+                }
+            }
+        }
+        uchar* g = grid.ptr(gr);
+        for (int gc = 0; gc < gw; gc ++) {
+            const uint32_t n = (r1 - r0) * (std::min<int>((gc + 1) * step, image.cols) - gc * step);
+            for (int b = 0; b < nb; b ++) g[gc * nb + b] = (sums[gc * nb + b] + n / 2) / n;
+        }
+    }
+
+    // Running median over the grid (Perreault and Hebert). Each column keeps a histogram of its
+    // values over the rows of the window, moving down a row adds one value to and removes one from
+    // each, and moving along a row adds one column histogram to the window histogram and removes
+    // another, so the cost per point does not depend on the window. Bands of rows are independent,
+    // each priming its own column histograms.
+    cv::Mat median(gh, gw, CV_32FC(nb));
+    const int nbands = std::max(1, std::min(4 * omp_get_max_threads(), gh));
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < nbands; band ++) {
+        const int r0 = (long)band * gh / nbands, r1 = (long)(band + 1) * gh / nbands;
+        std::vector<uint16_t> columns((size_t)gw * nb * 256, 0);
+        std::vector<uint32_t> hist((size_t)nb * 256);
+
+        const auto update = [&](const int r, const int delta) {
+            const uchar* g = grid.ptr(r);
+            for (int e = 0; e < gw * nb; e ++) columns[(size_t)e * 256 + g[e]] += delta;
+        };
+        const auto add_column = [&](const int c, const int sign) {
+            const uint16_t* column = columns.data() + (size_t)c * nb * 256;
+            if (sign > 0) for (int v = 0; v < nb * 256; v ++) hist[v] += column[v];
+            else for (int v = 0; v < nb * 256; v ++) hist[v] -= column[v];
+        };
+
+        for (int r = std::max(0, r0 - radius); r < std::min(gh, r0 + radius); r ++) update(r, 1);
+        for (int r = r0; r < r1; r ++) {
+            if (r + radius < gh) update(r + radius, 1);
+            if (r > r0 && r - radius - 1 >= 0) update(r - radius - 1, -1);
+            const uint32_t nrows = std::min(gh, r + radius + 1) - std::max(0, r - radius);
+
+            std::fill(hist.begin(), hist.end(), 0);
+            for (int c = 0; c < std::min(gw, radius); c ++) add_column(c, 1);
+            float* out = median.ptr<float>(r);
+            for (int c = 0; c < gw; c ++) {
+                if (c + radius < gw) add_column(c + radius, 1);
+                if (c - radius - 1 >= 0) add_column(c - radius - 1, -1);
+                const uint32_t n = nrows * (std::min(gw, c + radius + 1) - std::max(0, c - radius));
+                for (int b = 0; b < nb; b ++) out[c * nb + b] = _median(hist.data() + b * 256, n);
+            }
+        }
+    }
+
+    // Upsampling by exactly {step} puts each grid point at the centre of its block, the padding
+    // beyond the image is then cropped off
+    cv::Mat background;
+    cv::resize(median, background, cv::Size(gw * step, gh * step), 0, 0, cv::INTER_CUBIC);
+    return background(cv::Rect(0, 0, image.cols, image.rows));
+}
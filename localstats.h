@@ -0,0 +1,59 @@
+/*
+ * localstats.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Local statistics of single channel 8-bit images from
+ * summed-area tables (integral images) of the value and 
+ * its square, giving the mean and standard deviation of
+ * any rectangular window in constant time, and a sliding
+ * window median background map from running histograms.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "chunk.h"
+
+class LocalStats {
+public:
+    LocalStats(const cv::Mat &image);
+
+    const int rows, cols;
+
+    // Count, sum and sum of squares over the window [r0, r1) x [c0, c1), clipped to the image
+    inline void sums(long r0, long c0, long r1, long c1, int64_t &n, int64_t &s, int64_t &q) const {
+        r0 = std::max(r0, 0L);
+        c0 = std::max(c0, 0L);
+        r1 = std::min(r1, (long)rows);
+        c1 = std::min(c1, (long)cols);
+        const size_t a = r0 * stride + c0, b = r0 * stride + c1;
+        const size_t c = r1 * stride + c0, d = r1 * stride + c1;
+        n = (r1 - r0) * (c1 - c0);
+        s = sum[d] - sum[b] - sum[c] + sum[a];
+        q = sq[d] - sq[b] - sq[c] + sq[a];
+    }
+    Chunk window(const long r0, const long c0, const long r1, const long c1) const;
+
+private:
+    const size_t stride;
+    std::vector<int64_t> sum;
+    std::vector<int64_t> sq;
+};
+
+// Whole image statistics (including the median) from a histogram, over every channel or just {channel}
+Chunk image_stats(const cv::Mat &image, const int channel = -1);
+double histogram_median(const uint64_t* hist, const uint64_t n);
+
+// Background map of the 8-bit {image} (any number of channels) as CV_32FC(n), the median over the
+// {window} x {window} neighbourhood of each pixel. The medians are taken with running histograms
+// over a grid of {step} x {step} block means (by default {step} is {window} / 16) and upsampled
+// bicubically to the full resolution.
+cv::Mat median_background(const cv::Mat &image, const size_t window, size_t step = 0);
@@ -0,0 +1,84 @@
+/*
+ * mapfile.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the atomically written, memory mapped
+ * binary files.
+ *
+ */
+
+#include "mapfile.h"
+#include "enhance.h"
+
+size_t map_aligned(const size_t bytes) { return (bytes + map_align - 1) / map_align * map_align; }
+
+void write_aligned(std::ostream &out, const void* data, const size_t bytes) {
+    static const char zeros[map_align] = {0};
+    out.write((const char*)data, bytes);
+    out.write(zeros, map_aligned(bytes) - bytes);
+}
+
+void write_plane(std::ostream &out, const cv::Mat &m) {
+    static const char zeros[map_align] = {0};
+    const size_t row = m.cols * m.elemSize();
+    for (int r = 0; r < m.rows; r ++) out.write((const char*)m.ptr(r), row);
+    out.write(zeros, map_aligned(row * m.rows) - row * m.rows);
+}
+
+bool atomic_write(const std::string &file, const std::function<void(std::ofstream&)> &write, const std::string &what) {
+    // Written to a temporary and renamed so that a reader never maps a partial file. The temporary
+    // is named for the process, so that two runs writing the same file never share one.
+    const std::string tmp = file + "." + std::to_string(getpid()) + ".tmp";
+    std::error_code ec;
+    const fs::path dir = fs::path(file).parent_path();
+    if (!dir.empty()) fs::create_directories(dir, ec);
+    if (ec) {
+        std::cout << "Error - could not create the directory of " << what << " " << yellow << file << res << std::endl;
+        return false;
+    }
+
+    std::ofstream out(tmp, std::ios::binary);
+    if (!out) {
+        std::cout << "Error - could not create " << what << " " << yellow << tmp << res << std::endl;
+        return false;
+    }
+    write(out);
+    out.close();
+    if (!out) {
+        std::cout << "Error - could not write " << what << " " << yellow << tmp << res << std::endl;
+        fs::remove(tmp, ec);
+        return false;
+    }
+    fs::rename(tmp, file, ec);
+    if (ec) {
+        std::cout << "Error - could not write " << what << " " << yellow << file << res << std::endl;
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+MappedFile map_readonly_private(const std::string &file, const std::string &what, const size_t min_size) {
+    const int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < std::max<size_t>(min_size, 1)) {
+        if (fd >= 0) close(fd);
+        std::cout << "Error - could not read " << what << " " << yellow << file << res << std::endl;
+        return MappedFile();
+    }
+    const size_t len = st.st_size;
+    void* addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cout << "Error - could not map " << what << " " << yellow << file << res << std::endl;
+        return MappedFile();
+    }
+
+    MappedFile mapped;
+    mapped.data = (char*)addr;
+    mapped.size = len;
+    mapped.mapping = std::shared_ptr<void>(addr, [len](void* p) { munmap(p, len); });
+    return mapped;
+}
@@ -0,0 +1,45 @@
+/*
+ * mapfile.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Binary files of aligned blocks, written atomically and
+ * memory mapped on reuse. Shared by the calibration cache,
+ * the partial stacks and the decoded frame cache.
+ *
+ */
+
+#pragma once
+
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+const size_t map_align = 64;        // Every block of a mapped file starts on a multiple of this
+
+size_t map_aligned(const size_t bytes);
+
+// Write {bytes} of {data} or the rows of {m} (continuous or not) to {out}, padded to {map_align}
+void write_aligned(std::ostream &out, const void* data, const size_t bytes);
+void write_plane(std::ostream &out, const cv::Mat &m);
+
+// Create {file} (and its directory) with everything {write} writes to the stream. False (after
+// printing why, naming the file as {what}) on any failure, in which case {file} is left untouched.
+bool atomic_write(const std::string &file, const std::function<void(std::ofstream&)> &write, const std::string &what);
+
+struct MappedFile {
+    char* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<void> mapping;  // Unmaps the file once the last view onto it is gone
+
+    bool empty() const { return !data; }
+};
+
+// The whole of {file}, opened read only and mapped privately, so that views onto it may be
+// written to without the writes ever reaching the file. Empty (after printing why, naming the
+// file as {what}) if it cannot be opened or mapped, or is smaller than {min_size}.
+MappedFile map_readonly_private(const std::string &file, const std::string &what, const size_t min_size = 0);
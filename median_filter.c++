@@ -7,7 +7,8 @@
  * Simple routine which calculates a global median for each 
  * color channel and subtracts it off from the entire image.
  * Useful in normalizing deep-sky exposures with different 
- * brightnesses.
+ * brightnesses. The local mode instead subtracts the median
+ * of the window around each pixel, flattening gradients.
  *
  */
 
@@ -23,22 +24,26 @@ int main(int argn, char** argv) {
     long smoothing;
     long jitter;
     double filter_strength;
+    std::string cache;
 
    	po::options_description description("Usage");
 
 	try {
 		description.add_options()
 			("images,i", po::value<std::vector<std::string> >()->multitoken(), "The images on which to perform the subtraction.")
-			("mode,m", po::value<std::string>(&mode)->default_value("global"), "The filtering mode to apply: global, local, row, or column.")
+			("mode,m", po::value<std::string>(&mode)->default_value("global"), "The filtering mode to apply: global, local, row, col, rowcol or colrow.")
 			("normalize", po::bool_switch()->default_value(false), "Whether or not to normalize the channels collectively (false) or independently (true).")
 			("stretch", po::bool_switch()->default_value(false), "Whether or not to stretch the output to cover maximum brightness range")
 			("kernel,k", po::value<size_t>(&kernel)->default_value(10), "The kernel to use when filtering, i.e. the size of the region to sample"
-			                                                            " for each iteration of the filter. Does not apply to filtering mode 'global'")
+			                                                            " for each iteration of the filter, or the window of the local median (default 256"
+			                                                            " for mode 'local'). Does not apply to filtering mode 'global'")
 			("smoothing,s", po::value<long>(&smoothing)->default_value(0), "The smoothing factor for row and column based filtering. (The size"
 			                                                               " of the rolling average to use)")
 			("jitter,j", po::value<long>(&jitter)->default_value(0), "Jitter to apply to filter chunking, to prevent co-incident chunk boundaries"
 			                                                         " in an image stack.")
 			("filter_strength,f", po::value<double>(&filter_strength)->default_value(0.8), "Strength of the median filter, [0.0, 1.0]. Default 0.8.")
+			("cache", po::value<std::string>(&cache), "Directory of decoded frame caches, the images are decoded once and mapped on"
+			                                          " later runs over the same files. Optional.")
 		;
 	}
 	catch (...) {
@@ -67,21 +72,39 @@ int main(int argn, char** argv) {
 	else if (mode == "col") fmode = FilterMode::col;
 	else if (mode == "rowcol") fmode = FilterMode::rowcol;
 	else if (mode == "colrow") fmode = FilterMode::colrow;
+	else if (mode == "local") fmode = FilterMode::local;
+	else {
+		std::cout << "Error - unknown filtering mode " << yellow << mode << res << "." << std::endl;
+		exit(3);
+	}
+	// The row and column default is far too small for a local background
+	if (fmode == FilterMode::local && vm["kernel"].defaulted()) kernel = 256;
 
 	norm = vm["normalize"].as<bool>();
 	stretch = vm["stretch"].as<bool>();
 
-    std::vector<cv::Mat> images = read_images(files);
+    // Empty frames are kept for files which fail to open so that {images}[ii] is always {files}[ii]
+    FrameStack stack;
+    if (vm.count("cache")) {
+        stack = cached_frames(files, cache);
+        if (stack.empty()) std::cout << yellow << "Warning" << res << " - could not use the frame cache, decoding the images instead." << std::endl;
+    }
+    if (stack.empty()) stack.frames = read_batch(files, 0, files.size());
+    const std::vector<cv::Mat> &images = stack.frames;
 
     std::cout << "Performing " << mode << " median filtering... " << std::endl;
-    std::atomic<int> progress(0);
+    Progress progress(images.size());
     #pragma omp parallel for schedule(dynamic)
 	for (int ii = 0; ii < images.size(); ii ++) {
+        if (images[ii].empty()) {
+            progress.tick();
+            continue;
+        }
         cv::Mat subtracted = median_filter(images[ii], fmode, norm, stretch, kernel, smoothing, jitter, filter_strength);
 
         fs::path path(files[ii]);
-        cv::imwrite(path.replace_filename(path.stem().string()+"_msub"+path.extension().string()), subtracted);
+        write_image(path.replace_filename(path.stem().string()+"_msub"+path.extension().string()).string(), subtracted);
 
-        print_percent(progress++, images.size());
+        progress.tick();
 	}
 }
@@ -0,0 +1,76 @@
+/*
+ * merge.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Merges the partial stacks written by coadd --partial, e.g.
+ * for shards of a session coadded in separate processes or
+ * on separate machines, or a night's partial with the
+ * partial of the frames taken before it. The result is the
+ * same as coadding every frame of the shards at once.
+ *
+ * Usage: merge -i <partials> [--mode average|sigma|winsor]
+ *              [-k|--kappa] <kappa> [--iterations] <n>
+ *              [-o|--output] <file> [--partial <file>]
+ *
+ */
+
+#include "enhance.h"
+
+int main(int argn, char** argv) {
+	std::cout << res;
+	std::vector<std::string> files;
+	std::string mode;
+	std::string output;
+	std::string partial;
+	double kappa;
+	size_t iters;
+
+	po::options_description description("Usage");
+	try {
+		description.add_options()
+			("input,i", po::value<std::vector<std::string> >()->multitoken(), "The partial stacks to merge.")
+			("mode", po::value<std::string>(&mode)->default_value("average"), "The accumulation mode, options are average, sigma"
+				" (kappa-sigma clipped mean) or winsor (winsorized mean).")
+			("kappa,k", po::value<double>(&kappa)->default_value(2.5), "The rejection threshold in standard deviations for sigma and winsor.")
+			("iterations", po::value<size_t>(&iters)->default_value(5), "The maximum number of rejection iterations for sigma and winsor.")
+			("output,o", po::value<std::string>(&output)->default_value("./coadded.tif"), "The coadded image.")
+			("partial", po::value<std::string>(&partial), "Write the merged partial stack to this file instead of the coadded image.")
+		;
+	}
+	catch (...) {
+		std::cout << "Error in boost program options initialization" << std::endl;
+		exit(1);
+	}
+
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(argn, argv).options(description).run(), vm);
+		po::notify(vm);
+	}
+	catch (...) {
+		std::cout << description << std::endl;
+		exit(2);
+	}
+
+	if (vm.count("input")) files = vm["input"].as<std::vector<std::string> >();
+	else {
+		std::cout << "Error - must specify partial stacks to merge." << std::endl;
+		exit(3);
+	}
+
+	if (mode != "average" && mode != "sigma" && mode != "winsor") {
+		std::cout << "Error - unknown mode " << yellow << mode << res << std::endl;
+		exit(4);
+	}
+
+	const PartialStack merged = merge_partials(files);
+	if (merged.empty()) exit(5);
+
+	if (vm.count("partial")) {
+		if (!save_partial(merged, partial)) exit(6);
+		return 0;
+	}
+	write_image(output, merged.result(to_reduction(mode), kappa, iters));
+}
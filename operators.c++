@@ -44,35 +44,6 @@ std::vector<std::pair<double, double>> operator-(const std::vector<std::pair<dou
 
 cv::Size operator * (cv::Size l, double r) { return cv::Size(l.width * r, l.height * r); }
 
-// Current standard does not fully support atomic double
-void fetch_add(std::atomic<double>* shared, const double &h) {
-	double expected = shared->load();
-	while (!atomic_compare_exchange_weak(shared, &expected, expected + h))
-		;
-}
-
-// Not technically operators but definitely belong here
-double diff(const std::vector<std::pair<double, double>> &l, const std::vector<std::pair<double, double>> &r) {
-	// Protect against size mismatch
-	if (l.size() != r.size()) return double(0);
-	
-	// Static to minimize unnecessary allocations
-	static std::atomic<double> result;
-	result = 0;
-
-	// Parallelized sum of total separations (very brute force, very intensive).
-	// Also note that the range-based for syntax can't be used for outer loop with OMP
-	#pragma omp parallel for schedule(dynamic)
-	for (size_t ii = 0; ii < l.size(); ii ++) {
-		double min = distance(l[ii], r[0]);
-
-		// Retrieve the minimum distance
-		for (const auto &re : r) min = distance(l[ii], re) < min ? distance(l[ii], re) : min;
-		fetch_add(&result, min);
-	}
-	return result;
-}
-
 // This assumes T is a primitive, it will fail otherwise
 double distance(const std::pair<double, double> &l, const std::pair<double, double> &r) {
 	return (double)std::sqrt(std::pow(std::get<0>(l) - std::get<0>(r), 2) + std::pow(std::get<1>(l) - std::get<1>(r), 2));
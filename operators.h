@@ -26,6 +26,4 @@ std::vector<std::pair<double, double>> operator-(const std::vector<std::pair<dou
 cv::Size operator * (cv::Size l, double r);
 
 // Not technically operators but definitely belong here
-void fetch_add(std::atomic<double>* shared, const double &h);
-double diff(const std::vector<std::pair<double, double>> &l, const std::vector<std::pair<double, double>> &r);
 double distance(const std::pair<double, double> &l, const std::pair<double, double> &r);
@@ -0,0 +1,359 @@
+/*
+ * partial.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the mergeable partial stacks and their
+ * file format.
+ *
+ */
+
+#include "partial.h"
+#include "enhance.h"
+
+// File layout - the header followed by the count, sum, M2, bottom and top planes, each padded to
+// {map_align} bytes so that the mapped planes are aligned
+struct PartialHeader {
+    char magic[8];
+    int32_t rows, cols, channels, sketch;
+    uint64_t frames;
+    int32_t depth, reserved;            // Depth of the frames stacked, always CV_8U for now
+};
+const char partial_magic[8] = {'E', 'N', 'H', 'P', 'R', 'T', '0', '1'};
+
+// Insert {v} into the {n} (at most {k}) values of the sorted {s}, keeping the {k} first by {before}
+template <typename Compare>
+static inline void _insert(uchar* s, const size_t n, const size_t k, const uchar v, Compare before) {
+    size_t ii = std::min(n, k);
+    if (ii == k) {
+        if (!before(v, s[k - 1])) return;
+        ii --;
+    }
+    for (; ii > 0 && before(v, s[ii - 1]); ii --) s[ii] = s[ii - 1];
+    s[ii] = v;
+}
+
+// Merge the sorted {a} ({na} values) and {b} ({nb} values) into {out}, keeping the {k} first
+template <typename Compare>
+static inline void _merge(const uchar* a, const size_t na, const uchar* b, const size_t nb, uchar* out,
+                          const size_t k, Compare before) {
+    uchar merged[max_sketch];
+    size_t ia = 0, ib = 0, n = 0;
+    while (n < k && (ia < na || ib < nb)) {
+        if (ib >= nb || (ia < na && !before(b[ib], a[ia]))) merged[n++] = a[ia++];
+        else merged[n++] = b[ib++];
+    }
+    std::copy(merged, merged + n, out);
+}
+
+bool PartialStack::add(const cv::Mat &frame) {
+    if (frame.empty() || frame.depth() != CV_8U) {
+        std::cout << "Error - partial stacks only accept 8-bit frames." << std::endl;
+        return false;
+    }
+    if (empty() && count.empty()) {
+        rows = frame.rows;
+        cols = frame.cols;
+        channels = frame.channels();
+        count = cv::Mat::zeros(rows, cols, CV_32SC1);
+        sum = cv::Mat::zeros(rows, cols, CV_64FC(channels));
+        m2 = cv::Mat::zeros(rows, cols, CV_64FC(channels));
+        if (sketch) {
+            bottom = cv::Mat::zeros(rows, cols, CV_8UC(channels * sketch));
+            top = cv::Mat::zeros(rows, cols, CV_8UC(channels * sketch));
+        }
+    }
+    if (frame.rows != rows || frame.cols != cols || frame.channels() != channels) {
+        std::cout << "Error, shape mismatch on image with shape " << frame.rows << "x" << frame.cols;
+        std::cout << " expected " << rows << "x" << cols << ", skipping." << std::endl;
+        return false;
+    }
+
+    // Welford's update of the mean (kept as the sum) and M2 of each pixel
+    const size_t k = sketch, nb = channels;
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < rows; r ++) {
+        const uchar* pixel = frame.ptr(r);
+        int32_t* n = count.ptr<int32_t>(r);
+        double* s = sum.ptr<double>(r);
+        double* q = m2.ptr<double>(r);
+        uchar* lo = k ? bottom.ptr(r) : nullptr;
+        uchar* hi = k ? top.ptr(r) : nullptr;
+        for (int c = 0; c < cols; c ++) {
+            for (size_t b = 0; b < nb; b ++) {
+                const size_t e = c * nb + b;
+                const double x = pixel[e];
+                const double mean = n[c] ? s[e] / n[c] : x;
+                s[e] += x;
+                q[e] += (x - mean) * (x - s[e] / (n[c] + 1));
+                if (k) {
+                    _insert(lo + e * k, n[c], k, pixel[e], std::less<uchar>());
+                    _insert(hi + e * k, n[c], k, pixel[e], std::greater<uchar>());
+                }
+            }
+            n[c] ++;
+        }
+    }
+    frames ++;
+    return true;
+}
+
+bool PartialStack::merge(const PartialStack &other) {
+    if (other.empty()) return true;
+    if (empty()) {
+        rows = other.rows;
+        cols = other.cols;
+        channels = other.channels;
+        sketch = other.sketch;
+        frames = other.frames;
+        count = other.count.clone();
+        sum = other.sum.clone();
+        m2 = other.m2.clone();
+        bottom = other.bottom.clone();
+        top = other.top.clone();
+        mapping.reset();
+        return true;
+    }
+    if (other.rows != rows || other.cols != cols || other.channels != channels || other.sketch != sketch) {
+        std::cout << "Error - cannot merge a " << other.rows << "x" << other.cols << "x" << other.channels << " partial (sketch "
+                  << other.sketch << ") into a " << rows << "x" << cols << "x" << channels << " partial (sketch " << sketch << ")." << std::endl;
+        return false;
+    }
+
+    // Chan et al.'s pairwise combination, as [Chunk::operator+]
+    const size_t k = sketch, nb = channels;
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < rows; r ++) {
+        int32_t* na = count.ptr<int32_t>(r);
+        double* sa = sum.ptr<double>(r);
+        double* qa = m2.ptr<double>(r);
+        const int32_t* nb_ = other.count.ptr<int32_t>(r);
+        const double* sb = other.sum.ptr<double>(r);
+        const double* qb = other.m2.ptr<double>(r);
+        for (int c = 0; c < cols; c ++) {
+            if (!nb_[c]) continue;
+            const double n = na[c] + nb_[c];
+            for (size_t b = 0; b < nb; b ++) {
+                const size_t e = c * nb + b;
+                if (na[c]) {
+                    const double delta = sb[e] / nb_[c] - sa[e] / na[c];
+                    qa[e] += qb[e] + delta * delta * na[c] * nb_[c] / n;
+                }
+                else qa[e] = qb[e];
+                sa[e] += sb[e];
+                if (k) {
+                    uchar* lo = bottom.ptr(r) + e * k;
+                    uchar* hi = top.ptr(r) + e * k;
+                    const size_t ka = std::min<size_t>(na[c], k), kb = std::min<size_t>(nb_[c], k);
+                    _merge(lo, ka, other.bottom.ptr(r) + e * k, kb, lo, k, std::less<uchar>());
+                    _merge(hi, ka, other.top.ptr(r) + e * k, kb, hi, k, std::greater<uchar>());
+                }
+            }
+            na[c] += nb_[c];
+        }
+    }
+    frames += other.frames;
+    return true;
+}
+
+cv::Mat PartialStack::result(const Reduction mode, const double kappa, const size_t iters) const {
+    if (empty()) return cv::Mat();
+    if (mode == Reduction::median) {
+        std::cout << "Error - the median of a partial stack is not available, use a mean or clipped mode." << std::endl;
+        return cv::Mat();
+    }
+    if (mode != Reduction::mean && !sketch) {
+        std::cout << yellow << "Warning" << res << " - the partial has no sketch to clip with, using the mean." << std::endl;
+    }
+    const bool clip = mode != Reduction::mean && sketch;
+    const size_t k = sketch, nb = channels;
+
+    cv::Mat out(rows, cols, CV_8UC(channels));
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < rows; r ++) {
+        const int32_t* count_ = count.ptr<int32_t>(r);
+        const double* s = sum.ptr<double>(r);
+        const double* q = m2.ptr<double>(r);
+        uchar* o = out.ptr(r);
+        // Prefix sums of the sketched values and squares, the statistics with any number of
+        // extremes removed then follow in O(1) as in [_reduce_sorted]
+        double Sb[max_sketch + 1], Qb[max_sketch + 1], St[max_sketch + 1], Qt[max_sketch + 1];
+        for (int c = 0; c < cols; c ++) {
+            const size_t n = count_[c];
+            for (size_t b = 0; b < nb; b ++) {
+                const size_t e = c * nb + b;
+                if (!n) {
+                    o[e] = 0;
+                    continue;
+                }
+                if (!clip) {
+                    o[e] = cv::saturate_cast<uchar>(s[e] / n);
+                    continue;
+                }
+                const uchar* lo_ = bottom.ptr(r) + e * k;
+                const uchar* hi_ = top.ptr(r) + e * k;
+                const size_t ks = std::min(n, k);
+                Sb[0] = Qb[0] = St[0] = Qt[0] = 0;
+                for (size_t ii = 0; ii < ks; ii ++) {
+                    Sb[ii + 1] = Sb[ii] + lo_[ii];
+                    Qb[ii + 1] = Qb[ii] + lo_[ii] * lo_[ii];
+                    St[ii + 1] = St[ii] + hi_[ii];
+                    Qt[ii + 1] = Qt[ii] + hi_[ii] * hi_[ii];
+                }
+                const double S = s[e], Q = q[e] + s[e] * s[e] / n;
+
+                // Centred on the mean with the sketched extremes trimmed, robust like the median
+                const double centre = n > 2 * ks ? (S - Sb[ks] - St[ks]) / (n - 2 * ks) : S / n;
+
+                // {lo} of the lowest and {hi} of the highest values are rejected or winsorized
+                size_t lo = 0, hi = 0;
+                double low = lo_[0], high = hi_[0];
+                for (size_t it = 0; it < iters; it ++) {
+                    double mean, var;
+                    if (mode == Reduction::sigma_clip) {
+                        const double m = n - lo - hi;
+                        mean = (S - Sb[lo] - St[hi]) / m;
+                        var = (Q - Qb[lo] - Qt[hi]) / m - mean * mean;
+                    }
+                    else {
+                        const double wsum = lo * low + (S - Sb[lo] - St[hi]) + hi * high;
+                        const double wsq = lo * low * low + (Q - Qb[lo] - Qt[hi]) + hi * high * high;
+                        mean = wsum / n;
+                        var = wsq / n - mean * mean;
+                    }
+                    const double sd = std::sqrt(std::max(var, 0.0));
+                    size_t _lo = 0, _hi = 0;
+                    while (_lo < ks && lo_[_lo] < centre - kappa * sd) _lo ++;
+                    while (_hi < ks && hi_[_hi] > centre + kappa * sd) _hi ++;
+                    if (_lo + _hi >= n) break;
+
+                    low = centre - kappa * sd;
+                    high = centre + kappa * sd;
+                    if (_lo == lo && _hi == hi) break;
+                    lo = _lo;
+                    hi = _hi;
+                }
+                if (mode == Reduction::sigma_clip) o[e] = cv::saturate_cast<uchar>((S - Sb[lo] - St[hi]) / (n - lo - hi));
+                else o[e] = cv::saturate_cast<uchar>((lo * low + (S - Sb[lo] - St[hi]) + hi * high) / n);
+            }
+        }
+    }
+    return out;
+}
+
+PartialStack stream_partial(const std::vector<std::string> &files, const size_t budget, const size_t sketch) {
+// As [stream_coadd], decoding {files} in batches sized to fit {budget} alongside the partial
+    PartialStack partial(sketch);
+    size_t idx = 0;
+    cv::Mat frame;
+    while (frame.empty() && idx < files.size()) frame = read_image(files[idx++]);
+    if (frame.empty()) return partial;
+
+    const size_t frame_bytes = frame.total() * frame.elemSize();
+    const size_t partial_bytes = frame.total() * (sizeof(int32_t) + frame.channels() * (2 * sizeof(double) + 2 * partial.sketch));
+    size_t batch = 1;
+    if (budget > partial_bytes + frame_bytes) batch = (budget - partial_bytes) / frame_bytes;
+    else std::cout << yellow << "Warning" << res << " - memory budget is smaller than the partial stack, reading one frame at a time." << std::endl;
+
+    if (!partial.add(frame)) return partial;
+    frame.release();
+
+    std::cout << "Accumulating..." << std::endl;
+    Progress progress(files.size());
+    progress.tick(idx);
+    for (size_t start = idx; start < files.size(); start += batch) {
+        const size_t end = std::min(start + batch, files.size());
+        for (const auto &f : read_batch(files, start, end)) {
+            if (!f.empty()) partial.add(f);
+        }
+        progress.tick(end - start);
+    }
+    progress.finish();
+    return partial;
+}
+
+bool save_partial(const PartialStack &partial, const std::string &file) {
+    if (partial.empty()) return false;
+
+    PartialHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, partial_magic, sizeof(partial_magic));
+    header.rows = partial.rows;
+    header.cols = partial.cols;
+    header.channels = partial.channels;
+    header.sketch = partial.sketch;
+    header.frames = partial.frames;
+    header.depth = CV_8U;
+
+    const bool written = atomic_write(file, [&](std::ofstream &out) {
+        write_aligned(out, &header, sizeof(header));
+        for (const auto *m : {&partial.count, &partial.sum, &partial.m2}) write_plane(out, *m);
+        if (partial.sketch) for (const auto *m : {&partial.bottom, &partial.top}) write_plane(out, *m);
+    }, "partial stack");
+    if (written) std::cout << "Partial stack of " << partial.frames << " frames written to " << yellow << file << res << std::endl;
+    return written;
+}
+
+PartialStack load_partial(const std::string &file) {
+    // Private mapping, merging into a loaded partial must never write back to its file
+    const MappedFile mapped = map_readonly_private(file, "partial stack", sizeof(PartialHeader));
+    if (mapped.empty()) return PartialStack();
+    const size_t len = mapped.size;
+
+    const PartialHeader &header = *(const PartialHeader*)mapped.data;
+    const size_t pixels = (size_t)header.rows * header.cols;
+    const size_t values = pixels * header.channels;
+    const size_t expected = map_aligned(sizeof(PartialHeader)) + map_aligned(pixels * sizeof(int32_t)) + 2 * map_aligned(values * sizeof(double))
+                          + (header.sketch ? 2 * map_aligned(values * header.sketch) : 0);
+    if (std::memcmp(header.magic, partial_magic, sizeof(partial_magic)) || header.depth != CV_8U
+        || header.sketch < 0 || (size_t)header.sketch > max_sketch || expected != len) {
+        std::cout << "Error - partial stack " << yellow << file << res << " is corrupt, ignoring." << std::endl;
+        return PartialStack();
+    }
+
+    PartialStack partial(header.sketch);
+    partial.rows = header.rows;
+    partial.cols = header.cols;
+    partial.channels = header.channels;
+    partial.frames = header.frames;
+    partial.mapping = mapped.mapping;
+
+    char* data = mapped.data + map_aligned(sizeof(PartialHeader));
+    const auto plane = [&](const int type, const size_t bytes) {
+        cv::Mat m(header.rows, header.cols, type, data);
+        data += map_aligned(bytes);
+        return m;
+    };
+    partial.count = plane(CV_32SC1, pixels * sizeof(int32_t));
+    partial.sum = plane(CV_64FC(header.channels), values * sizeof(double));
+    partial.m2 = plane(CV_64FC(header.channels), values * sizeof(double));
+    if (header.sketch) {
+        partial.bottom = plane(CV_8UC(header.channels * header.sketch), values * header.sketch);
+        partial.top = plane(CV_8UC(header.channels * header.sketch), values * header.sketch);
+    }
+    return partial;
+}
+
+static PartialStack _merge_range(const std::vector<std::string> &files, const size_t lo, const size_t hi, bool &ok) {
+    if (hi - lo == 1) {
+        PartialStack partial = load_partial(files[lo]);
+        if (partial.empty()) ok = false;
+        return partial;
+    }
+    const size_t mid = lo + (hi - lo) / 2;
+    PartialStack left = _merge_range(files, lo, mid, ok);
+    if (!ok) return PartialStack();
+    const PartialStack right = _merge_range(files, mid, hi, ok);
+    if (!ok || !left.merge(right)) ok = false;
+    return left;
+}
+
+PartialStack merge_partials(const std::vector<std::string> &files) {
+    if (files.empty()) return PartialStack();
+    bool ok = true;
+    std::cout << "Merging " << files.size() << " partial stacks..." << std::endl;
+    PartialStack merged = _merge_range(files, 0, files.size(), ok);
+    if (!ok) return PartialStack();
+    return merged;
+}
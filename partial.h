@@ -0,0 +1,71 @@
+/*
+ * partial.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Mergeable partial stacks - the per-pixel count, sum and
+ * sum of squared deviations (M2) of a shard of frames, with
+ * optional sketches of the k lowest and highest values for
+ * clipped statistics. Partials of disjoint shards merge
+ * exactly (as [Chunk::operator+] does for chunks), so a
+ * session can be coadded across processes or machines and
+ * extended with new frames without revisiting the old ones.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "reduce.h"
+
+const size_t max_sketch = 16;       // Largest number of extremes kept per pixel and channel
+
+class PartialStack {
+public:
+    PartialStack(const size_t sketch = 0) : sketch(std::min(sketch, max_sketch)) {}
+
+    // Add an 8-bit frame, false if it does not match the frames already added
+    bool add(const cv::Mat &frame);
+
+    // Combine with the partial of another shard, false if the geometry or sketch size differ
+    bool merge(const PartialStack &other);
+
+    // The coadded CV_8U image. The clipped modes are as in [reduce_stack] but centred on the mean
+    // with the sketched extremes trimmed off (the median cannot be merged), and are exact as long
+    // as no more than {sketch} values on either side of a pixel are rejected. Without a sketch
+    // they fall back to the mean.
+    cv::Mat result(const Reduction mode = Reduction::mean, const double kappa = 2.5, const size_t iters = 5) const;
+
+    bool empty() const { return !frames; }
+
+    int rows = 0, cols = 0, channels = 0;
+    size_t sketch;
+    uint64_t frames = 0;
+
+    cv::Mat count;              // CV_32SC1 frames contributing to each pixel
+    cv::Mat sum;                // CV_64FC(n)
+    cv::Mat m2;                 // CV_64FC(n) sum of squared deviations from the mean
+    cv::Mat bottom;             // CV_8UC(n * sketch) lowest values of each channel, ascending
+    cv::Mat top;                // CV_8UC(n * sketch) highest values of each channel, descending
+
+    // Keeps the file mapping alive for partials loaded with [load_partial]
+    std::shared_ptr<void> mapping;
+};
+
+// Partial stack of {files}, decoded in batches sized to fit {budget} bytes as in [stream_coadd]
+PartialStack stream_partial(const std::vector<std::string> &files, const size_t budget, const size_t sketch);
+
+// Partial stack file, the planes of a loaded partial are views onto the (privately) mapped file
+bool save_partial(const PartialStack &partial, const std::string &file);
+PartialStack load_partial(const std::string &file);
+
+// Merge the partials in {files} pairwise in a tree, so that only one partial per level of the
+// tree is held at once and every sum adds terms of similar magnitude
+PartialStack merge_partials(const std::vector<std::string> &files);
@@ -0,0 +1,94 @@
+/*
+ * pipeline.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Runs a chain of the other routines (calibration, median
+ * filtering, depollution, alignment, coadding and star
+ * trails) in a single pass, keeping every frame in memory
+ * between stages instead of writing and re-reading
+ * intermediate files. The stages are given one per line in
+ * a config file and/or with repeated --stage arguments, see
+ * stages.h for the format.
+ *
+ * Usage: pipeline -i <files> [-m frames|video] [-c config]
+ *                 [-s "stage key=value ..."]... [-t threads]
+ *
+ * e.g.   pipeline -i *.tif -s "calibrate exposure=30 dark_exposure=30"
+ *                 -s "align" -s "coadd mode=sigma output=stacked.tif"
+ *
+ */
+
+#include "enhance.h"
+
+int main(int argn, char** argv) {
+	std::cout << res;
+	std::vector<std::string> files;
+	std::vector<std::string> stages;
+	std::string mode;
+	std::string config;
+	int nthreads = max_threads;
+
+	po::options_description description("Usage");
+	try {
+		description.add_options()
+			("input,i", po::value<std::vector<std::string> >()->multitoken(), "The images or videos to process.")
+			("mode,m", po::value<std::string>(&mode)->default_value("frames"), "Either {frames} if the inputs are image files or "
+			                                                                   "{video} if they are video files. Optional.")
+			("config,c", po::value<std::string>(&config), "File of stages, one per line, run before any --stage stages.")
+			("stage,s", po::value<std::vector<std::string> >(&stages), "A stage, e.g. \"median_filter mode=local kernel=256\". "
+			                                                            "May be repeated, the stages run in the order given.")
+			("threads,t", po::value<int>(&nthreads), "Frames processed concurrently. Optional.")
+		;
+	}
+	catch (...) {
+		std::cout << "Error in boost program options initialization" << std::endl;
+		exit(1);
+	}
+
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(argn, argv).options(description).run(), vm);
+		po::notify(vm);
+	}
+	catch (...) {
+		std::cout << description << std::endl;
+		exit(2);
+	}
+
+	if (vm.count("input")) files = vm["input"].as<std::vector<std::string> >();
+	else {
+		std::cout << "Error - must specify input files." << std::endl;
+		exit(3);
+	}
+
+	std::vector<StageSpec> specs;
+	if (vm.count("config")) {
+		std::ifstream in(config);
+		if (!in) {
+			std::cout << "Error - could not open config file " << yellow << config << res << std::endl;
+			exit(4);
+		}
+		specs = parse_stages(in);
+	}
+	for (const auto &stage : stages) {
+		const StageSpec spec = parse_stage(stage);
+		if (!spec.name.empty()) specs.push_back(spec);
+	}
+
+	Pipeline pipeline;
+	if (!pipeline.configure(specs)) exit(5);
+
+	if (nthreads > max_threads) nthreads = max_threads;
+	if (nthreads < 1) nthreads = 1;
+
+	std::unique_ptr<FrameSource> source;
+	if (mode == "video") source.reset(new VideoSource(files));
+	else source.reset(new ImageSource(files));
+
+	if (!pipeline.run(*source, nthreads)) {
+		std::cout << "Error - no frames reached the stack stages." << std::endl;
+		exit(6);
+	}
+}
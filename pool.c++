@@ -0,0 +1,103 @@
+/*
+ * pool.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Work-stealing thread pool.
+ *
+ */
+
+#include "pool.h"
+#include "enhance.h"
+
+// The pool (if any) that the calling thread works for and its index in that pool
+thread_local ThreadPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+ThreadPool::ThreadPool(const size_t n) : cursor(0), pending(0), queued(0), stopping(false) {
+    const size_t count = n ? n : 1;
+    for (size_t ii = 0; ii < count; ii ++) queues.emplace_back(new Worker);
+    for (size_t ii = 0; ii < count; ii ++) workers.emplace_back(&ThreadPool::run, this, ii);
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &w : workers) w.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    // Tasks submitted by a worker go to the back of its own deque, anything else is dealt out
+    // round-robin
+    const size_t target = current_pool == this ? current_worker : cursor++ % queues.size();
+    // Counted before it is published, so a worker can never take the task before it is counted
+    pending ++;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued ++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::next(const size_t self, std::function<void()> &task) {
+    {
+        Worker &own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t ii = 1; ii < queues.size(); ii ++) {
+        Worker &victim = *queues[(self + ii) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(const size_t self) {
+    current_pool = this;
+    current_worker = self;
+    // The workers run concurrently, so the parallel loops inside each task get an equal share
+    // of the cores rather than every worker starting a team the size of the machine
+    omp_set_num_threads(std::max<int>(1, std::thread::hardware_concurrency() / queues.size()));
+    std::function<void()> task;
+    while (true) {
+        if (next(self, task)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queued --;
+            }
+            task();
+            task = nullptr;
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * pool.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Work-stealing thread pool, bounded blocking queue and pipeline stage
+ * used to overlap decoding, registration and accumulation of frames.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// FIFO of at most {capacity} items, [push] blocks while full and [pop] while empty.
+// After [close] pushes are dropped and [pop] returns false once the queue drains.
+template <typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(const size_t capacity) : capacity(capacity ? capacity : 1) {}
+
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return items.size() < capacity || closed; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+
+private:
+    const size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+// Fixed set of workers each owning a task deque. Workers run their own tasks newest first
+// and steal the oldest task from a sibling when idle, so a task submitted from inside the
+// pool (a pipeline continuation) normally runs on the same core as its producer.
+class ThreadPool {
+public:
+    ThreadPool(const size_t n = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void wait();                                    // Block until every submitted task has finished
+    size_t size() const { return workers.size(); }
+
+private:
+    struct Worker {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    bool next(const size_t self, std::function<void()> &task);
+    void run(const size_t self);
+
+    std::vector<std::unique_ptr<Worker>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> cursor;                     // Round-robin target for external submissions
+    std::atomic<size_t> pending;                    // Submitted but not yet finished
+    std::atomic<size_t> queued;                     // Submitted but not yet started
+    std::atomic<bool> stopping;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+};
+
+// A pipeline stage - each item pushed is processed once by {fn} on the pool and then handed
+// to {emit}, normally the [push] of the following stage. Pushes only block when more than
+// {capacity} items are waiting, so callers bounding the items in flight to {capacity} never block.
+template <typename T>
+class Stage {
+public:
+    Stage(ThreadPool &pool, const size_t capacity, std::function<void(T&)> fn, std::function<void(T&&)> emit)
+        : pool(pool), queue(capacity), fn(fn), emit(emit) {}
+
+    void push(T &&item) {
+        queue.push(std::move(item));
+        pool.submit([this] {
+            T item;
+            if (!queue.pop(item)) return;
+            fn(item);
+            emit(std::move(item));
+        });
+    }
+
+private:
+    ThreadPool &pool;
+    BoundedQueue<T> queue;
+    std::function<void(T&)> fn;
+    std::function<void(T&&)> emit;
+};
@@ -17,181 +17,266 @@ int max_features;
 bool draw;
 double good_match_percent;
 double separation_adjustment;
-std::atomic<size_t> progress(0);
-
-void accumulate(const std::vector<cv::Mat> images, cv::Mat &m, const size_t &n) {
-    // Use a temp image to hold the conversion of each input image to CV_64FC3
-    // This will be allocated just the first time, since all the images have
-    // the same size.
-    cv::Mat temp(m.rows, m.cols, CV_64FC3);
-    for (auto im : images) {
-        im.convertTo(temp, CV_64FC3);
-        m += temp;
-        print_percent(progress++, n);
+
+void accumulate(const std::vector<cv::Mat> images, cv::Mat &m) {
+    Progress progress(images.size());
+    for (const auto &im : images) {
+        accumulate(im, m);
+        progress.tick();
+    }
+}
+void accumulate(const cv::Mat &image, cv::Mat &m) {
+    // Add {image} into the CV_64F accumulator {m} row by row, avoiding the CV_64F
+    // temporary that a [convertTo] followed by [+=] would need
+    Span span("accumulate");
+    const size_t len = image.cols * image.channels();
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < image.rows; r ++) {
+        const uchar* pixel = image.ptr(r);
+        double* sum = m.ptr<double>(r);
+        for (size_t e = 0; e < len; e ++) sum[e] += pixel[e];
     }
 }
 
 void subtract(const std::vector<std::string> files, const std::string &_darkframe, const double &factor) {
-    size_t idx = 0;
-    fs::path path;
-    std::vector<cv::Mat> images = read_images(files);
-    cv::Mat darkframe = read_image(_darkframe);
-    cv::Mat out;
-    for (const auto &im : images) {
-        path = fs::path(files[idx++]);
-        out = im - darkframe * factor;
-        cv::imwrite(path.replace_filename(path.stem().string()+"_sub"+path.extension().string()), out);
-        print_percent(idx, files.size());
-    }
+    // Single dark frame subtraction, as a calibration with only a dark master already scaled by
+    // {factor} (so that 0 subtracts nothing) and no exposure to rescale it by
+    Calibration cal;
+    const cv::Mat darkframe = read_image(_darkframe);
+    if (darkframe.empty()) return;
+    darkframe.convertTo(cal.dark, CV_32F, factor);
+    calibrate_files(files, cal, 0, "_sub");
 }
 
 cv::Mat coadd(const std::vector<cv::Mat> &images) {
-//    std::cout << "{max_features} - " << max_features << std::endl;
-//    std::cout << "{good_match_percent} - " << good_match_percent << std::endl;
-//    std::cout << "{separation_adjustment} - " << separation_adjustment << std::endl;
-    if (images.empty()) return cv::Mat();
+    std::cout << "Accumulating..." << std::endl;
+    return reduce_stack(images, Reduction::mean);
+}
+cv::Mat median_coadd(const std::vector<cv::Mat> &images) {
+// Takes the median at each pixel for a stack of images. Assumes the images
+// are aligned and that they are the same size.
+    std::cout << "Computing medians..." << std::endl;
+    return reduce_stack(images, Reduction::median);
+}
 
-    // Protect against hardware concurrency larger than number of images
-    const int nthreads = max_threads > images.size() ? images.size() : max_threads;
+cv::Mat stream_coadd(const std::vector<std::string> &files, const size_t budget) {
+// Average coadd which decodes {files} in batches sized to fit {budget} and adds each frame into
+// a running accumulator, so the stack is never held in memory. The sums are exact in double 
+// precision so the output is identical to [coadd] on the same images.
+    size_t idx = 0;
+    cv::Mat frame;
+    while (frame.empty() && idx < files.size()) frame = read_image(files[idx++]);
+    if (frame.empty()) return cv::Mat();
+
+    // Whatever the accumulator leaves of the budget goes to frames decoded in parallel
+    const size_t frame_bytes = frame.total() * frame.elemSize();
+    const size_t sum_bytes = frame.total() * frame.channels() * sizeof(double);
+    size_t batch = 1;
+    if (budget > sum_bytes + frame_bytes) batch = (budget - sum_bytes) / frame_bytes;
+    else std::cout << yellow << "Warning" << res << " - memory budget is smaller than the accumulator, reading one frame at a time." << std::endl;
+
+    cv::Mat m = cv::Mat::zeros(frame.rows, frame.cols, CV_64FC(frame.channels()));
+    accumulate(frame, m);
+    size_t n = 1;
+    frame.release();
 
-    // Create a 0 initialized image to use as accumulator for each thread
-    std::valarray<cv::Mat> m(cv::Mat(images[0].rows, images[0].cols, CV_64FC3), nthreads);
-    for (auto &e : m) {
-        e.setTo(cv::Scalar(0, 0, 0, 0));
+    std::cout << "Accumulating..." << std::endl;
+    Progress progress(files.size());
+    progress.tick(idx);
+    for (size_t start = idx; start < files.size(); start += batch) {
+        const size_t end = std::min(start + batch, files.size());
+        for (const auto &f : read_batch(files, start, end)) {
+            if (f.empty()) continue;
+            if (f.rows != m.rows || f.cols != m.cols || f.channels() != m.channels()) {
+                std::cout << "Error, shape mismatch on image with shape " << f.rows << "x" << f.cols;
+                std::cout << " expected " << m.rows << "x" << m.cols << ", skipping." << std::endl;
+                continue;
+            }
+            accumulate(f, m);
+            n ++;
+        }
+        progress.tick(end - start);
     }
+    progress.finish();
 
-    std::cout << "Accumulating..." << std::endl;
-    // Create either {nthreads} threads and give each a subset of images to process
-    // or create one thread for each image. The latter only when {nthreads} < {images.size()}
-    const size_t size = images.size();
-    const int block = size > nthreads ? size / nthreads : 1;
-    const int nt = block > 0 ? nthreads : size;
-    std::vector<std::thread> threads(nt);
-    std::vector<cv::Mat> v(nt);
-
-    progress = 0;   // Have to reset progress to zero because the same object is used for all progress tracking
-    print_percent(progress, size);
-    accumulate(images, m[0], size);
-/*    for (int ii = 0; ii < nt - 1; ii ++) {
-        threads[ii] = std::thread(accumulate, std::vector<cv::Mat>(images.begin() + ii * block, images.begin() + (ii + 1) * block), 
-                                  std::ref(m[ii]), std::ref(size));
-    }
-    threads.back() = std::thread(accumulate, std::vector<cv::Mat>(images.begin() + block * (nt - 1), images.end()),
-                                 std::ref(m[nt-1]), std::ref(size));
-    for (auto &t : threads) t.join();
-*/
-    
     std::cout << "Dividing... " << std::flush;
-    cv::Mat out(m[0].rows, m[0].cols, CV_64FC3);
-    out.setTo(cv::Scalar(0, 0, 0, 0));
-
-    // ISSUE std::ref not behaving as expected when calling [accumulate].
-    // Workaround of m[0].convertTo(...) instead of out.convertTo(...) is
-    // inefficient (discards threading advantages).
-    for (auto e : m) out += e;                        // Accumulate the arrays from the threads into a single array
-    m[0].convertTo(out, CV_8U, 1. / images.size()); // Convert back to CV_8U type, applying the division to get the actual mean
+    cv::Mat out;
+    m.convertTo(out, CV_8U, 1. / n);
     std::cout << bright+green+"done"+res+"." << std::endl;
-    
+
     return out;
 }
-cv::Mat median_coadd(const std::vector<cv::Mat> &images) {
-// Takes the median at each pixel for a stack of images. Assumes the images
-// are aligned and that they are the same size.
-    const int nthreads = max_threads > images[0].rows * images[0].cols ? 1 : max_threads;
-    std::vector<cv::Mat> _result(3, cv::Mat::zeros(images[0].rows, images[0].cols, CV_8UC1));
+ScratchStack::ScratchStack(const std::string &dir, const size_t expected) : expected(expected) {
+    const fs::path _dir = dir.empty() ? fs::temp_directory_path() : fs::path(dir);
+    directory = _dir.string();
+    path = (_dir / ("scratch_stack."+std::to_string(getpid())+"."+std::to_string((uintptr_t)this)+".raw")).string();
+
+    // A scratch stack in memory backed storage counts against memory just as the frames would
+    struct statfs sfs;
+    if (statfs(directory.c_str(), &sfs) == 0 && sfs.f_type == TMPFS_MAGIC) {
+        std::cout << yellow << "Warning" << res << " - scratch directory " << yellow << directory << res
+                  << " is a tmpfs, the scratch stack will be held in memory. Use --scratch to move it to disk." << std::endl;
+    }
 
-    // Calculate the size of the section of the image to be processed by each thead
-    size_t block = ceil(images[0].rows * images[0].cols / (double)nthreads);
-    size_t offset = 0;
-    size_t tidx = 1;
+    stack.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stack) {
+        std::cout << "Error - could not create scratch file " << yellow << path << res << std::endl;
+        failed = true;
+    }
+}
 
-    // Initialize the threads and pass appropriate arguments to each one
-    std::cout << "Computing medians..." << std::endl;
-    std::vector<std::thread> threads(nthreads);
-    for (long ii = 0; ii < nthreads - 1; ii ++, offset += block) {
-        threads[ii] = std::thread(_median_coadd, tidx++, images, std::ref(_result), offset, (offset + block) * 3);
+ScratchStack::~ScratchStack() {
+    stack.close();
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+bool ScratchStack::fail(const std::string &what) {
+    std::cout << "Error - " << what << " scratch file " << yellow << path << res << ", aborting." << std::endl;
+    failed = true;
+    return false;
+}
+
+bool ScratchStack::add(const cv::Mat &frame) {
+    if (failed || frame.empty()) return false;
+    if (!n) {
+        rows = frame.rows;
+        cols = frame.cols;
+        type = frame.type();
+        row_bytes = cols * frame.elemSize();
+
+        const uintmax_t needed = (uintmax_t)expected * rows * row_bytes;
+        std::error_code ec;
+        const fs::space_info space = fs::space(directory, ec);
+        if (!ec && space.available < needed) {
+            std::cout << "Error - the scratch stack needs " << (needed >> 20) << " MB but only " << (space.available >> 20)
+                      << " MB are free in " << yellow << directory << res << ", use --scratch to choose another directory." << std::endl;
+            failed = true;
+            return false;
+        }
     }
-    threads.back() = std::thread(_median_coadd, tidx++, images, std::ref(_result), offset, images[0].rows * images[0].cols * 3);
+    else if (frame.rows != rows || frame.cols != cols || frame.type() != type) {
+        std::cout << "Error, shape mismatch on image with shape " << frame.rows << "x" << frame.cols;
+        std::cout << " expected " << rows << "x" << cols << ", skipping." << std::endl;
+        return false;
+    }
+    Span span("write");
+    for (int r = 0; r < rows; r ++) stack.write(reinterpret_cast<const char*>(frame.ptr(r)), row_bytes);
+    if (!stack) return fail("could not write");
+    n ++;
+    return true;
+}
 
-    for (auto &t : threads) t.join();
+cv::Mat ScratchStack::reduce(const size_t budget, const Reduction mode, const double kappa, const size_t iters) {
+    if (failed || !n) return cv::Mat();
+    stack.flush();
+    if (!stack) {
+        fail("could not write");
+        return cv::Mat();
+    }
 
-    cv::Mat result;
-    cv::merge(_result, result);
-    
+    // One band from each frame plus the output must fit in the budget
+    const size_t band = std::clamp<size_t>(budget / ((n + 1) * row_bytes), 1, rows);
+    std::vector<uchar> buffer(n * band * row_bytes);
+    cv::Mat result(rows, cols, type);
+
+    std::cout << "Reducing over bands of " << band << " rows..." << std::endl;
+    Progress reducing(rows);
+    for (size_t r0 = 0; r0 < (size_t)rows; r0 += band) {
+        const size_t nr = std::min(band, rows - r0);
+        {
+            Span span("read");
+            for (size_t ii = 0; ii < n; ii ++) {
+                stack.seekg((ii * rows + r0) * row_bytes);
+                if (!stack) {
+                    fail("could not seek in");
+                    return cv::Mat();
+                }
+                stack.read(reinterpret_cast<char*>(buffer.data() + ii * band * row_bytes), nr * row_bytes);
+                if (!stack) {
+                    fail("could not read");
+                    return cv::Mat();
+                }
+            }
+        }
+
+        Span span("reduce");
+#pragma omp parallel for schedule(dynamic)
+        for (long r = 0; r < (long)nr; r ++) {
+            std::vector<const uchar*> rowstack(n);
+            for (size_t ii = 0; ii < n; ii ++) rowstack[ii] = buffer.data() + (ii * band + r) * row_bytes;
+            ::reduce(rowstack, result.ptr(r0 + r), row_bytes, mode, kappa, iters);
+        }
+        reducing.tick(nr);
+    }
+    reducing.finish();
     return result;
 }
-void _median_coadd(const int tidx, const std::vector<cv::Mat> &images, std::vector<cv::Mat> &output, size_t offset, const size_t end) {
-// Abstraction for parallel execution of [median()]. Hard coded for use with 3-channel input 
-// only (pointer stuff would get too complicated otherwise).
-//    std::cout << "Thread "+std::to_string(tidx)+" started. Region: "+std::to_string(offset)+" through "+std::to_string(end)+"\n" << std::flush;
-    const size_t n = images.size();
-    std::vector<uchar> pixels(n);   // Initialize vector to store pixel values
-    const bool even = (n % 2);
-
-    // Array of pointers to the start of this thread's block of the output
-    std::array<uchar*, 3> start;
-    for (auto ii = 0; ii < 3; ii ++) start[ii] = output[ii].ptr(0, 0) + offset;
-
-    // Pointers to the starts of the input images
-    std::vector<uchar*> img_ptrs(n);
-    for (size_t ii = 0; ii < n; ii ++) img_ptrs[ii] = (uchar*)images[ii].ptr(0, 0);
-
-    size_t im;
-    size_t total = images[0].rows * images[0].cols;
-    for (offset; offset < end; offset += 3) {
-        print_percent(progress++, total);
-        for (size_t c = 0; c < 3; c ++, im = 0) {
-            // Extract relevant pixel info for this location and channel
-            for (auto &p : pixels) p = *(img_ptrs[im++] + offset + c);
-
-            // Sort pixel values for this channel and location accross all images
-            std::sort(std::begin(pixels), std::end(pixels), [](const uchar &l, const uchar &r) { return l < r; }); 
-            if (even) *(start[c]) = pixels[n / 2 - 1] / 2 + pixels[n / 2] / 2;      // Unusual order of operations is to prevent uchar overflow
-            else *(start[c]) = pixels[n / 2];
-            
-            start[c] ++;        // Can't have this in the loop syntax because it will produce UB
+
+cv::Mat stream_reduce(const std::vector<std::string> &files, const size_t budget, const Reduction mode,
+                      const double kappa, const size_t iters, const std::string &scratch_dir) {
+// Stack reduction (median, clipped mean etc.) which holds at most {budget} bytes of image data. Each 
+// frame is decoded once into an uncompressed scratch stack on disk, and the reduction is then computed 
+// over bands of rows, reading only the rows of the current band from each frame on each pass.
+    ScratchStack stack(scratch_dir, files.size());
+    if (!stack.good()) return cv::Mat();
+
+    // The frame size is only known after the first read, until then read one at a time
+    size_t batch = 1;
+    std::cout << "Decoding frames to scratch stack " << stack.file() << "..." << std::endl;
+    Progress decoding(files.size());
+    for (size_t start = 0; start < files.size() && stack.good(); start += batch) {
+        const size_t end = std::min(start + batch, files.size());
+        for (const auto &f : read_batch(files, start, end)) {
+            if (f.empty()) continue;
+            if (!stack.add(f) && !stack.good()) break;
+            batch = std::max<size_t>(1, budget / (f.total() * f.elemSize()));
         }
+        decoding.tick(end - start);
     }
-    std::cout << std::endl;
+    decoding.finish();
+    return stack.reduce(budget, mode, kappa, iters);
 }
 
-std::vector<cv::Mat> scrub_hot_pixels(const std::vector<cv::Mat> images) {
-    cv::Mat m = images[0];
-    const cv::Vec3b zero(0, 0, 0);
-    int idx = 0;
-    long hot = 0;
-    std::cout << "Scrubbing hot pixels..." << std::endl;
-    for (auto image : std::vector<cv::Mat>(images.begin() + 1, images.end())) {
-        if (image.rows != m.rows || image.cols != m.cols) {
+std::vector<cv::Mat> scrub_hot_pixels(std::vector<cv::Mat> images, const std::string &dump) {
+    // A pixel is hot if it is lit in the first image and every other image is at least 5 (summed over
+    // the channels) darker there. The hot pixel values are then subtracted from every image.
+    if (images.empty()) return images;
+    for (const auto &image : images) {
+        if (image.rows != images[0].rows || image.cols != images[0].cols || image.type() != CV_8UC3) {
             std::cout << "Error, shape mismatch on image with shape " << image.rows << "x" << image.cols;
-            std::cout << " expected " << m.rows << "x" << m.cols << std::endl;
+            std::cout << " expected " << images[0].rows << "x" << images[0].cols << std::endl;
             return images;
         }
-#pragma omp parallel for schedule(dynamic)
-        for (int r = 0; r < m.rows; r ++) {
-            for (int c = 0; c < m.cols; c ++) {
-                if (m.at<cv::Vec3b>(r, c) != zero && (m.at<cv::Vec3b>(r, c) - image.at<cv::Vec3b>(r, c)) < 5) {
-                    m.at<cv::Vec3b>(r, c) = zero;
-                }
-            }
-        }
-        print_percent(idx++, images.size() - 1);
     }
-#pragma omp parallel for schedule(dynamic)
+    cv::Mat m = cv::Mat::zeros(images[0].rows, images[0].cols, CV_8UC3);
+    const cv::Vec3b zero(0, 0, 0);
+    long hot = 0;
+    std::cout << "Scrubbing hot pixels..." << std::endl;
+
+    // One pass over the pixels, each testing the whole stack, and then the subtraction of any
+    // hot pixel found from every image while the row is still in cache
+#pragma omp parallel for schedule(static) reduction(+:hot)
     for (int r = 0; r < m.rows; r ++) {
-        for (int c = 0; c < m.cols; c++) {
-            if (m.at<cv::Vec3b>(r, c) != zero) {
-                #pragma omp critical
-                    hot++;
+        const cv::Vec3b* first = images[0].ptr<cv::Vec3b>(r);
+        cv::Vec3b* pixel = m.ptr<cv::Vec3b>(r);
+        for (int c = 0; c < m.cols; c ++) {
+            if (first[c] == zero) continue;
+            bool scrub = true;
+            for (size_t ii = 1; ii < images.size() && scrub; ii ++) {
+                scrub = !((first[c] - images[ii].ptr<cv::Vec3b>(r)[c]) < 5);
             }
+            if (!scrub) continue;
+            pixel[c] = first[c];
+            hot ++;
+        }
+        for (auto &image : images) {
+            cv::Vec3b* p = image.ptr<cv::Vec3b>(r);
+            for (int c = 0; c < m.cols; c ++) if (pixel[c] != zero) p[c] -= pixel[c];
         }
     }
     std::cout << "Found " << hot << " hot pixels." << std::endl;
-    cv::imwrite("./hot_pixels.tif", m);
-#pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < images.size(); i ++) {
-        images[i] -= m;
-    }
+    if (!dump.empty()) cv::imwrite(dump, m);
     return images;
 }
 
@@ -218,10 +303,10 @@ cv::Mat4b advanced_coadd(const std::vector<cv::Mat> images, double threshold) {
     uchar max = find_max(images);
     std::cout << "Maximum is " << (int)max << std::endl;
     std::cout << "Performing selective coadding ..." << std::endl;
-    progress = 0;
+    Progress progress(images.size());
     for (auto image : images) {
         long transparent = 0;
-        print_percent(progress++, images.size());
+        progress.tick();
         cv::Mat current(image.rows, image.cols, CV_32FC4);
         cv::cvtColor(image, current, cv::COLOR_BGR2BGRA);
         std::cout << type2str(current.type()) << std::endl;
@@ -244,6 +329,7 @@ cv::Mat4b advanced_coadd(const std::vector<cv::Mat> images, double threshold) {
 //            std::cout << "No pixels detected below threshold" << std::endl;
         }
     }
+    progress.finish();
     std::cout << "Accumulating..." << std::endl; 
     for (int ii = 0; ii < modified.size(); ii ++) {
         modified[ii].convertTo(modified[ii], CV_32FC4);
@@ -261,13 +347,15 @@ cv::Mat4b advanced_coadd(const std::vector<cv::Mat> images, double threshold) {
     }
     cv::imwrite("temp.png", m);
     std::cout << "Dividing... " << std::endl;
+    Progress dividing(m.rows);
     for (int ii = 0; ii < m.rows; ii ++) {
-        print_percent(ii, m.rows);
+        dividing.tick();
         for (int jj = 0; jj < m.cols; jj ++) {
             m.at<cv::Vec4b>(ii, jj) = m.at<cv::Vec4b>(ii, jj) / (double)mask[ii][jj];
         }
     }
-    
+    dividing.finish();
+
     std::cout << "Converting... " << std::flush;
     cv::Mat4b output(m.rows, m.cols, CV_32FC4);
 //    cv::cvtColor(m, output, cv::COLOR_BGRA2BGR);
@@ -276,90 +364,77 @@ cv::Mat4b advanced_coadd(const std::vector<cv::Mat> images, double threshold) {
     return output;
 }
 
-void align_stars(cv::Mat &anc, cv::Mat &com, cv::Mat &result) {
-    // Do a downhill minimization by repeatedly sampling the translation-rotation-pespective
-    // parameter space and iteratively refining. This method works best for images with dim or 
-    // no foreground and little star trailing. For images that do not satisfy this, [align_images]
-    // should be used instead.
+bool align_stars(cv::Mat &anc, cv::Mat &com, cv::Mat &result, const Motion motion) {
+    // Register {com} onto {anc} by matching triangle asterisms between the two star fields
+    // and warping {com} with the recovered transform. This method works best for images with
+    // dim or no foreground and little star trailing. For images that do not satisfy this,
+    // [align_images] should be used instead.
     // {anc} - anchor image
     // {com} - comparison image
     // {result} - result after alignment
+    // {motion} - model fitted between the two fields (similarity or affine)
+    return align_stars(star_field(anc), anc.size(), com, result, motion);
+}
 
-    // NOTE Should be arguments
-    const size_t n = 25; 
-    const size_t iters = 4;
-
-    // Extract a mask of only the brightest stars (within 0.5% of max brightness)
-    const cv::Mat anc_stars = brightness_find_legacy(anc, find_max({anc}), 2);
-    const cv::Mat com_stars = brightness_find_legacy(com, find_max({com}), 2);
-
-    // Convert star masks into vector of positions
-    const std::vector<std::pair<double, double>> anc_pos = star_positions(anc_stars, 100);
-    const std::vector<std::pair<double, double>> com_pos = star_positions(com_stars, 100);
-
-    // Track the location and value of the minimum difference
-    double min = diff(anc_pos, com_pos);
-    std::tuple<double, double, double> where = std::make_tuple(0, 0, 0);
-
-    // Keep track of the size of the current parameter subspace.
-    double rot_it = Pi*2;
-    double x_it = (anc.cols + com.cols);
-    double y_it = (anc.rows + com.rows);
-
-    std::cout << "Aligning by star field..." << std::endl;
-    // Do the iteratively refined minimization
-    for (size_t ii = 0; ii < iters; ii ++, rot_it /= n, x_it /= n, y_it /=n) {
-
-        // Reduce the search space according to the location of the minimum in the previous iteration
-        std::pair<double, double> rot_lim = std::make_pair(-rot_it / 2.0, rot_it / 2.0) + std::get<0>(where);
-        std::pair<double, double> x_lim = std::make_pair(-x_it / 2.0, x_it / 2.0) + std::get<1>(where);
-        std::pair<double, double> y_lim = std::make_pair(-y_it / 2.0, y_it / 2.0) + std::get<2>(where);
-
-        // Would prefer the loop iterators be floating point instead of storing the whole vector, but OMP doesn't work like that :(
-        std::vector<double> _rot = linspace(rot_lim, n);
-        std::vector<double> _x = linspace(x_lim, n);
-        std::vector<double> _y = linspace(y_lim, n);
-
-        for (const auto &rot : _rot) {
-            for (const auto &x : _x) {
-                for (const auto &y : _y) {
-                    double _diff = diff(anc_pos, rotate(com_pos, rot) - std::make_pair(x, y));
-                    if (_diff < min) {
-                        min = _diff;
-                        where = std::make_tuple(rot, x, y);
-                    }
-                }
-            }
+bool align_stars(const StarField &ref, const cv::Size &size, cv::Mat &com, cv::Mat &result, const Motion motion) {
+    // As above, but against a precomputed anchor field {ref} so that stacks only detect the 
+    // anchor's stars once. {size} is the size of the anchor image.
+    const StarField field = star_field(com);
+
+    Affine t;
+    if (!register_fields(ref, field, motion, t)) {
+        if (!quiet()) {
+            std::cout << yellow << "Warning" << res << " - unable to register star fields (" << ref.stars.size() 
+                      << " and " << field.stars.size() << " stars found)." << std::endl;
         }
-        print_percent(ii, iters);
+        return false;
     }
-    std::cout << std::get<0>(where) << " " << std::get<1>(where) << " " << std::get<2>(where) << std::endl;
-    std::cout << min << std::endl;
+    Span span("warp");
+    cv::warpAffine(com, result, to_mat(t), size, cv::INTER_CUBIC);
+    return true;
 }
 
 void align_images(cv::Mat &im1, cv::Mat &im2, cv::Mat &im1Reg) {
     // Performs feature based alignment of {im1} to {im2}.
-    cv::Mat im1Gray, im2Gray, h;
-
-    // Convert images to grayscale
-    cvtColor(im1, im1Gray, cv::COLOR_BGR2GRAY);
-    cvtColor(im2, im2Gray, cv::COLOR_BGR2GRAY);
-    
-    // Variables to store keypoints and descriptors
-    std::vector<cv::KeyPoint> keypoints1, keypoints2;
-    cv::Mat descriptors1, descriptors2;
+    const Features f1 = describe(im1);
+    const Features f2 = describe(im2);
+    const std::vector<cv::DMatch> matches = match_features(f1, f2);
+    std::cout << "{matches.size()} - " << matches.size() << std::endl;
     
-    // Detect ORB features and compute descriptors.
+    // Draw best matches
+    if (draw) {
+        cv::Mat imMatches;
+        cv::drawMatches(im1, f1.keypoints, im2, f2.keypoints, matches, imMatches);
+        cv::imwrite("matches.jpg", imMatches);
+    }
+        
+    // Use homography to warp image
+    const cv::Mat h = homography(f1, f2, matches);
+    std::cout << "(" << h.size().width << "x" << h.size().height << ")" << std::endl;
+    Span span("warp");
+    cv::warpPerspective(im1, im1Reg, h, im2.size());
+}
+
+Features describe(const cv::Mat &image) {
+    // Detect ORB features and compute descriptors on the grayscale of {image}
+    Span span("detect");
+    Features f;
+    cv::Mat gray = image;
+    if (image.channels() == 3) cvtColor(image, gray, cv::COLOR_BGR2GRAY);
     cv::Ptr<cv::Feature2D> orb = cv::ORB::create(max_features);
-    orb->detectAndCompute(im1Gray, cv::Mat(), keypoints1, descriptors1);
-    orb->detectAndCompute(im2Gray, cv::Mat(), keypoints2, descriptors2);
-    
-    // Match features.
+    orb->detectAndCompute(gray, cv::Mat(), f.keypoints, f.descriptors);
+    return f;
+}
+
+std::vector<cv::DMatch> match_features(const Features &f1, const Features &f2) {
+    // Match the descriptors of {f1} against {f2}, keeping the best {good_match_percent} (at least 4)
+    Span span("register");
     std::vector<cv::DMatch> matches;
+    if (f1.descriptors.empty() || f2.descriptors.empty()) return matches;
     cv::Ptr<cv::DescriptorMatcher> matcher = cv::DescriptorMatcher::create("BruteForce-Hamming");
-    matcher->match(descriptors1, descriptors2, matches, cv::Mat());
+    matcher->match(f1.descriptors, f2.descriptors, matches, cv::Mat());
     
-    std::vector<double> separations = find_separations(matches, keypoints1, keypoints2);
+    std::vector<double> separations = find_separations(matches, f1.keypoints, f2.keypoints);
     
     // Sort matches by score
     std::vector<std::pair<double, cv::DMatch> > paired;
@@ -375,32 +450,20 @@ void align_images(cv::Mat &im1, cv::Mat &im2, cv::Mat &im1Reg) {
     }
         
     std::sort(matches.begin(), matches.end());
-    const int numGoodMatches = (matches.size() * good_match_percent > 3 ? matches.size() * good_match_percent : 4);
-    matches.erase(matches.begin()+numGoodMatches, matches.end());   
-    std::cout << "{matches.size()} - " << matches.size() << std::endl;
-    
-    // Draw best matches
-    if (draw) {
-        cv::Mat imMatches;
-        cv::drawMatches(im1, keypoints1, im2, keypoints2, matches, imMatches);
-        cv::imwrite("matches.jpg", imMatches);
-   }
-        
-    // Extract location of good matches
+    const size_t numGoodMatches = (matches.size() * good_match_percent > 3 ? matches.size() * good_match_percent : 4);
+    if (matches.size() > numGoodMatches) matches.erase(matches.begin()+numGoodMatches, matches.end());   
+    return matches;
+}
+
+cv::Mat homography(const Features &f1, const Features &f2, const std::vector<cv::DMatch> &matches) {
+    // Homography taking the points of {f1} onto {f2}, empty if there are too few {matches}
+    if (matches.size() < 4) return cv::Mat();
     std::vector<cv::Point2f> points1, points2;
-    
-    for (int ii = 0; ii < matches.size(); ii ++) {
-        points1.push_back(keypoints1[matches[ii].queryIdx].pt);
-        points2.push_back(keypoints2[matches[ii].trainIdx].pt);
+    for (const auto &m : matches) {
+        points1.push_back(f1.keypoints[m.queryIdx].pt);
+        points2.push_back(f2.keypoints[m.trainIdx].pt);
     }
-    
-    // Find homography
-    h = cv::findHomography(points1, points2, cv::RANSAC);
-    
-    // Use homography to warp image
-    std::cout << "(" << h.size().width << "x" << h.size().height << ")" << std::endl;
-    cv::warpPerspective(im1, im1Reg, h, im2.size());
-    
+    return cv::findHomography(points1, points2, cv::RANSAC);
 }
  
 // Calculates the separation (pixel distance) between two matched features
@@ -420,70 +483,72 @@ void interpolate_simple(cv::Mat &im, const Blob &blob) {
     
 }
 
-// Extract blobs from a binary image mask in CV_8U1C colorspace
+// Extract blobs from a binary image mask in CV_8UC1 colorspace
 std::vector<Blob> blob_extract(const cv::Mat &mask) {
-    std::vector<Blob> blobs;
-    uchar* pixel;
-    uchar* start = const_cast<uchar*>(mask.ptr(0, 0));
-
-    // Iterate using pointer arithmetic for efficiency (assumes contiguous storage)
-    for (pixel = start; pixel < mask.ptr(mask.rows - 1, mask.cols - 1); pixel ++) {
-        if (*pixel) {  // If the current pixel value is non-zero
-            Blob blob;
-            _blob_extract(mask, blob, pixel, start);
-            blobs.push_back(blob);
+    // Pixels are labelled by [label_components] so each blob is gathered in one linear pass, 
+    // the perimeter being the background pixels 4-adjacent to the blob
+    size_t count;
+    const cv::Mat labels = label_components(mask, count);
+    std::vector<Blob> blobs(count);
+    if (labels.empty()) return blobs;
+
+    for (int r = 0; r < labels.rows; r ++) {
+        const int32_t* label = labels.ptr<int32_t>(r);
+        for (int c = 0; c < labels.cols; c ++) {
+            if (!label[c]) continue;
+            Blob &blob = blobs[label[c] - 1];
+            blob.to_blob({r, c});
+            if (r > 0 && !labels.ptr<int32_t>(r - 1)[c]) blob.to_perim({r - 1, c});
+            if (r < labels.rows - 1 && !labels.ptr<int32_t>(r + 1)[c]) blob.to_perim({r + 1, c});
+            if (c > 0 && !label[c - 1]) blob.to_perim({r, c - 1});
+            if (c < labels.cols - 1 && !label[c + 1]) blob.to_perim({r, c + 1});
         }
     }
-    
+    for (auto &blob : blobs) blob.compact();
     return blobs;
 }
 
-// Recursive function to extract a single blob given an image mask and a starting pixel 
-void _blob_extract(const cv::Mat &mask, Blob &blob, uchar* pixel, uchar* start) {
-
-    Pos p { (pixel - start) / mask.cols, (pixel - start) % mask.cols };
-    if (*pixel) {
-        blob.to_blob(p);
-        _blob_extract(mask, blob, pixel + 1, start);
-        _blob_extract(mask, blob, pixel + mask.rows, start);
-    }
-    else blob.to_perim(p);
-    
-}
-
 cv::Mat median_filter(const cv::Mat &image, const FilterMode mode, const bool norm, const bool stretch, 
                       const size_t _kernel, const long smoothing, const long jitter, const double filter_strength) {
+    Span span("model");
     cv::Mat out(image.rows, image.cols, image.type());
     const size_t nb = image.channels();
 
-    // TODO Implement rolling-window filtering for row, column, and local filtering.
+    // TODO Implement rolling-window filtering for row and column filtering (local filtering
+    //      is done with the running median of [median_background]).
     //      Calculate the median in each kernel, and add 1 / kernel_size * median to 
     //      a running total. Subtract the running total at the end for smooth median
     //      subtraction. 
 
     std::mt19937 gen;
-    std::uniform_int_distribution<> jitterer = prng((_kernel - 1) < jitter ? -jitter : -(_kernel - 1), jitter, gen);
+    // Kernels vary by up to {jitter} either way (never below 1), so no jitter gives a fixed kernel
+    const long reach = std::clamp<long>(jitter, 0, std::max<long>((long)_kernel - 1, 0));
+    std::uniform_int_distribution<> jitterer = prng(-reach, std::max<long>(jitter, 0), gen);
     size_t kernel = _kernel + jitterer(gen);
 
     if (mode == FilterMode::global) {
         if (norm) {
             for (int b = 0; b < nb; b ++) {
-                cv::Mat channel(image.rows, image.cols, CV_8UC1);
-                cv::extractChannel(image, channel, b);
-                Chunk chunk = gaussian_estimate(channel.ptr(0, 0), channel.cols, Extent { 0, channel.cols, 0, channel.rows });
-
-                uchar* pixel = out.ptr(0, 0) + b;
-                for (size_t rc = 0; rc < channel.total(); rc ++, pixel += nb) {
-                    double filter = chunk.median * filter_strength;
-                    *pixel = channel.data[rc] > filter ? channel.data[rc] - filter : 0;
+                const double filter = image_stats(image, b).median * filter_strength;
+#pragma omp parallel for schedule(static)
+                for (int r = 0; r < image.rows; r ++) {
+                    const uchar* ipixel = image.ptr(r) + b;
+                    uchar* pixel = out.ptr(r) + b;
+                    for (int c = 0; c < image.cols; c ++, ipixel += nb, pixel += nb) {
+                        *pixel = *ipixel > filter ? *ipixel - filter : 0;
+                    }
                 }
             }
         }
         else {
-            Chunk chunk = gaussian_estimate(image.ptr(0, 0), image.cols, Extent { 0, image.cols, 0, image.rows });
-            uchar* pixel = out.ptr(0, 0);
-            for (size_t rc = 0; rc < image.rows * image.cols * nb; rc ++, pixel ++) {
-                *pixel = image.data[rc] > chunk.median ? image.data[rc] - chunk.median : 0;
+            const double median = image_stats(image).median;
+#pragma omp parallel for schedule(static)
+            for (int r = 0; r < image.rows; r ++) {
+                const uchar* ipixel = image.ptr(r);
+                uchar* pixel = out.ptr(r);
+                for (size_t e = 0; e < image.cols * nb; e ++) {
+                    pixel[e] = ipixel[e] > median ? ipixel[e] - median : 0;
+                }
             }
         }
     }
@@ -534,6 +599,20 @@ cv::Mat median_filter(const cv::Mat &image, const FilterMode mode, const bool no
             }
         }
     }
+    else if (mode == FilterMode::local) {
+        // Subtract the median over the {_kernel} x {_kernel} window around each pixel, unjittered so
+        // that every frame of a stack gets the same background model
+        const cv::Mat background = median_background(image, _kernel);
+        if (background.empty()) return cv::Mat();
+        const size_t len = image.cols * nb;
+#pragma omp parallel for schedule(static)
+        for (int r = 0; r < image.rows; r ++) {
+            const uchar* ipixel = image.ptr(r);
+            const float* bg = background.ptr<float>(r);
+            uchar* pixel = out.ptr(r);
+            for (size_t e = 0; e < len; e ++) pixel[e] = cv::saturate_cast<uchar>(ipixel[e] - filter_strength * bg[e]);
+        }
+    }
     else if (mode == FilterMode::rowcol) {
         out = median_filter(image, FilterMode::row, kernel);
         normalize(out, 0.75);
@@ -11,22 +11,76 @@
 
 #include "enhance.h"
 #include "chunk.h"
+#include "reduce.h"
+#include "registration.h"
 
-enum class FilterMode {global, row, col, rowcol, colrow};
+enum class FilterMode {global, row, col, rowcol, colrow, local};
 
-void accumulate(const std::vector<cv::Mat> images, cv::Mat &m, const size_t &n);
+void accumulate(const std::vector<cv::Mat> images, cv::Mat &m);
+void accumulate(const cv::Mat &image, cv::Mat &m);
 void subtract(const std::vector<std::string> files, 
               const std::string &_darkframe, const double &factor = 1.0);
 
 cv::Mat coadd(const std::vector<cv::Mat> &images);
 cv::Mat median_coadd(const std::vector<cv::Mat> &images);
-void _median_coadd(const int tidx, const std::vector<cv::Mat> &images, std::vector<cv::Mat> &output, size_t offset, const size_t end);
 
-std::vector<cv::Mat> scrub_hot_pixels(const std::vector<cv::Mat> images);
+// Streaming coadds which read {files} as they are needed, holding at most {budget} bytes of image data
+cv::Mat stream_coadd(const std::vector<std::string> &files, const size_t budget);
+// [stream_reduce] keeps its scratch stack (one uncompressed copy of every frame) in {scratch_dir}, or
+// the system temporary directory if empty, and returns an empty image if it cannot be written in full
+cv::Mat stream_reduce(const std::vector<std::string> &files, const size_t budget, const Reduction mode = Reduction::median,
+                      const double kappa = 2.5, const size_t iters = 5, const std::string &scratch_dir = "");
 
-void align_stars(cv::Mat &anc, cv::Mat &com, cv::Mat &result);
+// Uncompressed stack of equally shaped frames in a scratch file under {dir} (the system temporary
+// directory if empty), removed on destruction. Any failure to write or read the file is reported
+// and leaves the stack failed, [reduce] then returning an empty image rather than stale data. If
+// {expected} frames are given the free space for all of them is checked at the first [add].
+class ScratchStack {
+public:
+    ScratchStack(const std::string &dir = "", const size_t expected = 0);
+    ~ScratchStack();
+    ScratchStack(const ScratchStack&) = delete;
+    ScratchStack& operator=(const ScratchStack&) = delete;
+
+    // False if {frame} does not match the frames already added (it is skipped) or the stack failed
+    bool add(const cv::Mat &frame);
+
+    // Reduce over bands of rows, holding at most {budget} bytes of image data
+    cv::Mat reduce(const size_t budget, const Reduction mode, const double kappa = 2.5, const size_t iters = 5);
+
+    bool good() const { return !failed; }
+    size_t size() const { return n; }
+    const std::string& file() const { return path; }
+
+private:
+    bool fail(const std::string &what);
+
+    std::string directory, path;
+    std::fstream stack;
+    const size_t expected;
+    size_t n = 0, row_bytes = 0;
+    int rows = 0, cols = 0, type = 0;
+    bool failed = false;
+};
+
+// Subtract the pixels which are lit in every image from each image, writing the hot pixel map to {dump} if given
+std::vector<cv::Mat> scrub_hot_pixels(std::vector<cv::Mat> images, const std::string &dump = "");
+
+// Registers {com} onto {anc} by star field, returns false if no consistent transform was found
+bool align_stars(cv::Mat &anc, cv::Mat &com, cv::Mat &result, const Motion motion = Motion::similarity);
+bool align_stars(const StarField &ref, const cv::Size &size, cv::Mat &com, cv::Mat &result, 
+                 const Motion motion = Motion::similarity);
 void align_images(cv::Mat &im1, cv::Mat &im2, cv::Mat &imreg);				// Aligns two given images and stores aligned result in {imreg}
 
+// ORB keypoints and descriptors of one image, computed once and shared read-only between matches
+struct Features {
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+};
+Features describe(const cv::Mat &image);
+std::vector<cv::DMatch> match_features(const Features &f1, const Features &f2);
+cv::Mat homography(const Features &f1, const Features &f2, const std::vector<cv::DMatch> &matches);
+
 // Calculates the separation (pixel distance) between two matched features
 double find_separation(cv::DMatch m, std::vector<cv::KeyPoint> kp1, std::vector<cv::KeyPoint> kp2);
 // Calculates the separation (pixel distance) between all matched features in {matches}
@@ -34,7 +88,6 @@ std::vector<double> find_separations(std::vector<cv::DMatch> matches, std::vecto
 
 void interpolate_simple(cv::Mat &im, const cv::Mat &starmask);
 std::vector<Blob> blob_extract(const cv::Mat &im);
-void _blob_extract(const cv::Mat &mask, Blob &blob, uchar* pixel, uchar* start);
 
 cv::Mat median_filter(const cv::Mat &image, const FilterMode mode=FilterMode::global, const bool norm=false, 
                       const bool stretch=false, const size_t kernel=10, const long smoothing=0, const long jitter=0,
@@ -0,0 +1,218 @@
+/*
+ * reduce.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Reduction kernels for image stacks - mean, median, 
+ * kappa-sigma clipped mean and winsorized mean. 
+ *
+ */
+
+#include "reduce.h"
+#include "enhance.h"
+
+cv::Mat reduce_stack(const std::vector<cv::Mat> &images, const Reduction mode, const double kappa, const size_t iters,
+                     const int depth) {
+    Span span("reduce");
+    if (images.empty()) return cv::Mat();
+    if (images[0].depth() != CV_8U || (depth != CV_8U && depth != CV_32F)) {
+        std::cout << "Error - stacks must be 8-bit and reduce to 8-bit or 32-bit float." << std::endl;
+        return cv::Mat();
+    }
+    // Images which do not match the first are skipped, as the streamed reductions skip them
+    std::vector<const cv::Mat*> kept;
+    kept.reserve(images.size());
+    for (const auto &im : images) {
+        if (im.rows != images[0].rows || im.cols != images[0].cols || im.type() != images[0].type()) {
+            std::cout << "Error, shape mismatch on image with shape " << im.rows << "x" << im.cols;
+            std::cout << " expected " << images[0].rows << "x" << images[0].cols << ", skipping." << std::endl;
+            continue;
+        }
+        kept.push_back(&im);
+    }
+    const size_t n = kept.size();
+    cv::Mat result(images[0].rows, images[0].cols, CV_MAKETYPE(depth, images[0].channels()));
+
+    // Split each row into tiles such that a tile of the whole stack stays in cache. The tiles 
+    // are disjoint so each thread owns its region of the output and nothing needs merging.
+    const size_t row = images[0].cols * images[0].channels();
+    const size_t tile = std::min(row, std::max(reduce_lanes, reduce_tile_bytes / n / reduce_lanes * reduce_lanes));
+    const size_t per_row = (row + tile - 1) / tile;
+    const long ntiles = per_row * result.rows;
+
+    Progress progress(ntiles);
+#pragma omp parallel for schedule(dynamic)
+    for (long t = 0; t < ntiles; t ++) {
+        const int r = t / per_row;
+        const size_t c = (t % per_row) * tile;
+
+        std::vector<const uchar*> stack(n);
+        for (size_t ii = 0; ii < n; ii ++) stack[ii] = kept[ii]->ptr(r) + c;
+        if (depth == CV_32F) reduce(stack, result.ptr<float>(r) + c, std::min(tile, row - c), mode, kappa, iters);
+        else reduce(stack, result.ptr(r) + c, std::min(tile, row - c), mode, kappa, iters);
+        progress.tick();
+    }
+    progress.finish();
+
+    return result;
+}
+
+template <typename T>
+void reduce(const std::vector<const uchar*> &stack, T* out, const size_t len, const Reduction mode, 
+            const double kappa, const size_t iters) {
+    const size_t n = stack.size();
+    if (!n) return;
+    if (mode == Reduction::mean) return _reduce_mean(stack, out, len);
+
+    // Scratch space is per-thread and reused between tiles
+    thread_local std::vector<uchar> block;
+    thread_local std::vector<uchar> column;
+    block.resize(n * reduce_lanes);
+    column.resize(n);
+
+    const bool network = n <= network_max;
+    const auto &comparators = sorting_network(network ? n : 1);
+    for (size_t e = 0; e < len; e += reduce_lanes) {
+        const size_t w = std::min(reduce_lanes, len - e);
+
+        // Transpose the next {reduce_lanes} pixels of each image into a lane of {block}
+        for (size_t ii = 0; ii < n; ii ++) std::memcpy(block.data() + ii * reduce_lanes, stack[ii] + e, w);
+
+        if (network) {
+            // Sort every lane at once, each comparator being a vector min/max
+            for (const auto &cmp : comparators) {
+                uchar* a = block.data() + cmp.first * reduce_lanes;
+                uchar* b = block.data() + cmp.second * reduce_lanes;
+#pragma omp simd
+                for (size_t l = 0; l < reduce_lanes; l ++) {
+                    const uchar lo = std::min(a[l], b[l]);
+                    b[l] = std::max(a[l], b[l]);
+                    a[l] = lo;
+                }
+            }
+            if (mode == Reduction::median) {
+                const uchar* lo = block.data() + (n - 1) / 2 * reduce_lanes;
+                const uchar* hi = block.data() + n / 2 * reduce_lanes;
+                if (std::is_same<T, uchar>::value) {
+#pragma omp simd
+                    for (size_t l = 0; l < w; l ++) out[e + l] = (lo[l] + hi[l]) / 2;
+                }
+                else {
+#pragma omp simd
+                    for (size_t l = 0; l < w; l ++) out[e + l] = (lo[l] + hi[l]) * 0.5f;
+                }
+                continue;
+            }
+        }
+
+        for (size_t l = 0; l < w; l ++) {
+            if (network) {
+                for (size_t ii = 0; ii < n; ii ++) column[ii] = block[ii * reduce_lanes + l];
+            }
+            else {
+                // Large stacks are sorted by counting, which is linear in the stack size
+                uint32_t counts[256] = {0};
+                for (size_t ii = 0; ii < n; ii ++) counts[block[ii * reduce_lanes + l]] ++;
+                uchar* s = column.data();
+                for (int v = 0; v < 256; v ++) s = std::fill_n(s, counts[v], (uchar)v);
+            }
+            out[e + l] = _reduce_sorted<T>(column.data(), n, mode, kappa, iters);
+        }
+    }
+}
+template void reduce<uchar>(const std::vector<const uchar*>&, uchar*, const size_t, const Reduction, const double, const size_t);
+template void reduce<float>(const std::vector<const uchar*>&, float*, const size_t, const Reduction, const double, const size_t);
+
+template <typename T>
+void _reduce_mean(const std::vector<const uchar*> &stack, T* out, const size_t len) {
+    thread_local std::vector<uint32_t> sums;
+    sums.assign(len, 0);
+    for (const auto &p : stack) {
+#pragma omp simd
+        for (size_t e = 0; e < len; e ++) sums[e] += p[e];
+    }
+
+    // Same rounding as [cv::Mat::convertTo] so the result matches the accumulator based coadds
+    const double scale = 1. / stack.size();
+    for (size_t e = 0; e < len; e ++) out[e] = cv::saturate_cast<T>(sums[e] * scale);
+}
+
+template <typename T>
+T _reduce_sorted(const uchar* s, const size_t n, const Reduction mode, const double kappa, const size_t iters) {
+// Reduce the values {s}, which must be sorted ascending. Both rejection modes are centered on the 
+// median, which is unaffected by the bright outliers (satellites, planes) we want to reject.
+    if (mode == Reduction::median) {
+        if (std::is_same<T, uchar>::value) return (s[(n - 1) / 2] + s[n / 2]) / 2;
+        return (s[(n - 1) / 2] + s[n / 2]) * 0.5f;
+    }
+    const double med = (s[(n - 1) / 2] + s[n / 2]) / 2.0;
+
+    // Prefix sums of values and squares give the statistics of any range of {s} in O(1)
+    thread_local std::vector<uint64_t> S, Q;
+    S.resize(n + 1);
+    Q.resize(n + 1);
+    S[0] = Q[0] = 0;
+    for (size_t ii = 0; ii < n; ii ++) {
+        S[ii + 1] = S[ii] + s[ii];
+        Q[ii + 1] = Q[ii] + s[ii] * s[ii];
+    }
+
+    // Values in [lo, hi) are kept as is, those outside are either rejected or winsorized
+    size_t lo = 0, hi = n;
+    double low = s[0], high = s[n - 1];
+    for (size_t it = 0; it < iters; it ++) {
+        double mean, var;
+        if (mode == Reduction::sigma_clip) {
+            const double m = hi - lo;
+            mean = (S[hi] - S[lo]) / m;
+            var = (Q[hi] - Q[lo]) / m - mean * mean;
+        }
+        else {
+            const double wsum = lo * low + (S[hi] - S[lo]) + (n - hi) * high;
+            const double wsq = lo * low * low + (Q[hi] - Q[lo]) + (n - hi) * high * high;
+            mean = wsum / n;
+            var = wsq / n - mean * mean;
+        }
+        const double sd = std::sqrt(std::max(var, 0.0));
+        const size_t _lo = std::lower_bound(s, s + n, med - kappa * sd) - s;
+        const size_t _hi = std::upper_bound(s, s + n, med + kappa * sd) - s;
+        if (_hi <= _lo) break;
+
+        low = med - kappa * sd;
+        high = med + kappa * sd;
+        if (_lo == lo && _hi == hi) break;
+        lo = _lo;
+        hi = _hi;
+    }
+
+    if (mode == Reduction::sigma_clip) return cv::saturate_cast<T>((S[hi] - S[lo]) / double(hi - lo));
+    return cv::saturate_cast<T>((lo * low + (S[hi] - S[lo]) + (n - hi) * high) / n);
+}
+
+const std::vector<std::pair<uint16_t, uint16_t>>& sorting_network(const size_t n) {
+// Batcher's odd-even merge sort for {n} inputs, built once per stack size for each thread
+    thread_local size_t size = 0;
+    thread_local std::vector<std::pair<uint16_t, uint16_t>> network;
+    if (size == n) return network;
+
+    network.clear();
+    for (size_t p = 1; p < n; p <<= 1) {
+        for (size_t k = p; k >= 1; k >>= 1) {
+            for (size_t j = k % p; j + k < n; j += 2 * k) {
+                for (size_t ii = 0; ii < std::min(k, n - j - k); ii ++) {
+                    if ((ii + j) / (2 * p) == (ii + j + k) / (2 * p)) network.emplace_back(ii + j, ii + j + k);
+                }
+            }
+        }
+    }
+    size = n;
+    return network;
+}
+
+Reduction to_reduction(const std::string &mode) {
+    if (mode == "median") return Reduction::median;
+    if (mode == "sigma") return Reduction::sigma_clip;
+    if (mode == "winsor") return Reduction::winsorize;
+    return Reduction::mean;
+}
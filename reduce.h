@@ -0,0 +1,44 @@
+/*
+ * reduce.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Per-pixel reduction kernels for stacks of aligned 8-bit
+ * images. Each thread reduces a cache-sized tile of the
+ * stack at a time, gathering the tile into lanes so that
+ * the comparisons vectorize across neighbouring pixels.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+enum class Reduction {mean, median, sigma_clip, winsorize};
+
+const size_t reduce_lanes = 64;              // Pixels reduced together by the vectorized kernels
+const size_t reduce_tile_bytes = 1 << 18;    // Stack bytes per tile, sized to stay resident in L2
+const size_t network_max = 128;              // Largest stack sorted with a sorting network instead of by counting
+
+// Reduce {images} to a single image of the same size and channels, with {depth} either CV_8U or
+// CV_32F (which keeps the fractional part, for calibration masters). Images whose shape or type
+// differ from the first are skipped.
+cv::Mat reduce_stack(const std::vector<cv::Mat> &images, const Reduction mode, 
+                     const double kappa = 2.5, const size_t iters = 5, const int depth = CV_8U);
+
+// Reduce the {len} values following each pointer in {stack} into {out}, instantiated for uchar and float
+template <typename T>
+void reduce(const std::vector<const uchar*> &stack, T* out, const size_t len, const Reduction mode,
+            const double kappa = 2.5, const size_t iters = 5);
+template <typename T>
+void _reduce_mean(const std::vector<const uchar*> &stack, T* out, const size_t len);
+template <typename T>
+T _reduce_sorted(const uchar* s, const size_t n, const Reduction mode, const double kappa, const size_t iters);
+
+const std::vector<std::pair<uint16_t, uint16_t>>& sorting_network(const size_t n);
+Reduction to_reduction(const std::string &mode);
@@ -0,0 +1,249 @@
+/*
+ * registration.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of star field registration by triangle
+ * asterism matching
+ *
+ */
+
+#include "registration.h"
+#include "enhance.h"
+
+KDTree::KDTree(const std::vector<std::pair<double, double>> &points) : pts(points), idx(points.size()) {
+    std::iota(idx.begin(), idx.end(), 0);
+    build(0, idx.size(), 0);
+}
+
+void KDTree::build(const size_t lo, const size_t hi, const int axis) {
+    // The median on {axis} of [lo, hi) is the node, with the halves either side as its subtrees
+    if (hi - lo < 2) return;
+    const size_t mid = (lo + hi) / 2;
+    std::nth_element(idx.begin() + lo, idx.begin() + mid, idx.begin() + hi, [&](const size_t &l, const size_t &r) {
+        return axis ? pts[l].second < pts[r].second : pts[l].first < pts[r].first;
+    });
+    build(lo, mid, !axis);
+    build(mid + 1, hi, !axis);
+}
+
+void KDTree::search(const std::pair<double, double> &p, const size_t lo, const size_t hi, const int axis,
+                    const size_t k, std::vector<std::pair<double, size_t>> &best) const {
+    if (lo >= hi) return;
+    const size_t mid = (lo + hi) / 2;
+    const auto &node = pts[idx[mid]];
+    const double dx = p.first - node.first, dy = p.second - node.second;
+    const double d2 = dx * dx + dy * dy;
+
+    // {best} is kept sorted, closest first, and holds at most {k} entries
+    if (best.size() < k || d2 < best.back().first) {
+        best.insert(std::upper_bound(best.begin(), best.end(), std::make_pair(d2, idx[mid])), std::make_pair(d2, idx[mid]));
+        if (best.size() > k) best.pop_back();
+    }
+
+    const double split = axis ? dy : dx;
+    if (split < 0) {
+        search(p, lo, mid, !axis, k, best);
+        if (best.size() < k || split * split < best.back().first) search(p, mid + 1, hi, !axis, k, best);
+    }
+    else {
+        search(p, mid + 1, hi, !axis, k, best);
+        if (best.size() < k || split * split < best.back().first) search(p, lo, mid, !axis, k, best);
+    }
+}
+
+std::vector<size_t> KDTree::nearest(const std::pair<double, double> &p, const size_t k) const {
+    std::vector<std::pair<double, size_t>> best;
+    best.reserve(k + 1);
+    search(p, 0, idx.size(), 0, k, best);
+
+    std::vector<size_t> result;
+    for (const auto &b : best) result.push_back(b.second);
+    return result;
+}
+
+long KDTree::nearest(const std::pair<double, double> &p, const double radius) const {
+    std::vector<std::pair<double, size_t>> best;
+    search(p, 0, idx.size(), 0, 1, best);
+    if (best.empty() || best[0].first > radius * radius) return -1;
+    return best[0].second;
+}
+
+StarField star_field(const cv::Mat &image, const size_t n, const size_t neighbours) {
+// Catalog the {n} largest stars in {image} and the asterisms formed with their neighbours
+    return star_field(star_positions(gaussian_find(image, 8), n), neighbours);
+}
+
+StarField star_field(const std::vector<std::pair<double, double>> &stars, const size_t neighbours) {
+    StarField field;
+    field.stars = stars;
+    field.tree = KDTree(stars);
+
+    // Each star forms a triangle with every pair of its nearest neighbours. Neighbouring stars 
+    // propose many of the same triangles, so these are deduplicated by their sorted vertices.
+    std::vector<std::array<int, 3>> seen;
+    for (size_t ii = 0; ii < stars.size(); ii ++) {
+        const std::vector<size_t> near = field.tree.nearest(stars[ii], neighbours + 1);
+        for (size_t jj = 1; jj < near.size(); jj ++) {
+            for (size_t kk = jj + 1; kk < near.size(); kk ++) {
+                std::array<int, 3> v = {(int)ii, (int)near[jj], (int)near[kk]};
+                std::sort(v.begin(), v.end());
+                seen.push_back(v);
+            }
+        }
+    }
+    std::sort(seen.begin(), seen.end());
+    seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+
+    std::vector<std::pair<double, double>> shapes;
+    for (const auto &v : seen) {
+        // Side opposite each vertex
+        std::array<std::pair<double, int>, 3> sides;
+        for (int s = 0; s < 3; s ++) sides[s] = std::make_pair(distance(stars[v[(s + 1) % 3]], stars[v[(s + 2) % 3]]), v[s]);
+        std::sort(sides.begin(), sides.end(), [](const auto &l, const auto &r) { return l.first > r.first; });
+        if (sides[2].first < 1) continue;   // Degenerate
+
+        Triangle t;
+        t.v = {sides[0].second, sides[1].second, sides[2].second};
+        t.shape = std::make_pair(sides[1].first / sides[0].first, sides[2].first / sides[0].first);
+        field.triangles.push_back(t);
+        shapes.push_back(t.shape);
+    }
+    field.shapes = KDTree(shapes);
+
+    return field;
+}
+
+bool register_fields(const StarField &ref, const StarField &com, const Motion motion, Affine &transform, const double tolerance) {
+// Find the transform taking the stars of {com} onto those of {ref}, accepting stars within {tolerance} pixels
+    Span span("register");
+    const double shape_tolerance = 0.01;
+    const size_t max_hypotheses = 1000;
+
+    // Every triangle of {com} whose shape matches a triangle of {ref} proposes a correspondence of three stars
+    std::vector<std::pair<size_t, size_t>> matches;
+    for (size_t t = 0; t < com.triangles.size(); t ++) {
+        const long r = ref.shapes.nearest(com.triangles[t].shape, shape_tolerance);
+        if (r >= 0) matches.emplace_back(r, t);
+    }
+    if (matches.empty()) return false;
+    if (matches.size() > max_hypotheses) {
+        std::mt19937 gen(matches.size());
+        std::shuffle(matches.begin(), matches.end(), gen);
+        matches.resize(max_hypotheses);
+    }
+
+    // Stars of {com} which land within {tolerance} of a star in {ref} under {t}
+    auto inliers = [&](const Affine &t, std::vector<std::pair<double, double>> &from, std::vector<std::pair<double, double>> &to) {
+        from.clear();
+        to.clear();
+        for (const auto &star : com.stars) {
+            const long r = ref.tree.nearest(apply(t, star), tolerance);
+            if (r < 0) continue;
+            from.push_back(star);
+            to.push_back(ref.stars[r]);
+        }
+        return from.size();
+    };
+
+    // RANSAC over the triangle correspondences. The minimal sample for a similarity is 2 stars so
+    // a triangle is already over-determined, and for affine it is exactly 3.
+    size_t best = 0;
+    Affine t;
+    std::vector<std::pair<double, double>> from(3), to(3);
+    for (const auto &m : matches) {
+        for (int v = 0; v < 3; v ++) {
+            from[v] = com.stars[com.triangles[m.second].v[v]];
+            to[v] = ref.stars[ref.triangles[m.first].v[v]];
+        }
+        Affine h;
+        if (!fit_motion(from, to, motion, h)) continue;
+
+        // Frames from the same camera should be close to the same scale
+        const double scale = std::sqrt(std::abs(h[0] * h[4] - h[1] * h[3]));
+        if (scale < 0.8 || scale > 1.25) continue;
+
+        std::vector<std::pair<double, double>> _from, _to;
+        const size_t count = inliers(h, _from, _to);
+        if (count > best) {
+            best = count;
+            t = h;
+        }
+    }
+    if (best < 4) return false;
+
+    // Refine by least squares over all inliers, then once more with any stars the refinement gained
+    for (int it = 0; it < 2; it ++) {
+        inliers(t, from, to);
+        if (!fit_motion(from, to, motion, t)) return false;
+    }
+    transform = t;
+    return true;
+}
+
+bool fit_motion(const std::vector<std::pair<double, double>> &from, const std::vector<std::pair<double, double>> &to, 
+                const Motion motion, Affine &t) {
+// Least squares transform taking {from} to {to}
+    const size_t n = from.size();
+    if (n < (motion == Motion::similarity ? 2 : 3)) return false;
+
+    if (motion == Motion::similarity) {
+        // Closed form: rotation and scale from the centered cross- and dot-products
+        std::pair<double, double> mf(0, 0), mt(0, 0);
+        for (size_t ii = 0; ii < n; ii ++) {
+            mf = mf + from[ii];
+            mt = mt + to[ii];
+        }
+        mf = std::make_pair(mf.first / n, mf.second / n);
+        mt = std::make_pair(mt.first / n, mt.second / n);
+
+        double s = 0, a = 0, b = 0;
+        for (size_t ii = 0; ii < n; ii ++) {
+            const auto p = from[ii] - mf, q = to[ii] - mt;
+            s += p.first * p.first + p.second * p.second;
+            a += p.first * q.first + p.second * q.second;
+            b += p.first * q.second - p.second * q.first;
+        }
+        if (s <= 0) return false;
+        a /= s;
+        b /= s;
+        t = {a, -b, mt.first - (a * mf.first - b * mf.second), b, a, mt.second - (b * mf.first + a * mf.second)};
+        return true;
+    }
+
+    // Affine, from the normal equations shared by both output coordinates
+    Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d bx = Eigen::Vector3d::Zero(), by = Eigen::Vector3d::Zero();
+    for (size_t ii = 0; ii < n; ii ++) {
+        const Eigen::Vector3d p(from[ii].first, from[ii].second, 1);
+        A += p * p.transpose();
+        bx += p * to[ii].first;
+        by += p * to[ii].second;
+    }
+    Eigen::FullPivLU<Eigen::Matrix3d> lu(A);
+    if (!lu.isInvertible()) return false;
+    const Eigen::Vector3d x = lu.solve(bx), y = lu.solve(by);
+    t = {x(0), x(1), x(2), y(0), y(1), y(2)};
+    return true;
+}
+
+std::pair<double, double> apply(const Affine &t, const std::pair<double, double> &p) {
+    return std::make_pair(t[0] * p.first + t[1] * p.second + t[2], t[3] * p.first + t[4] * p.second + t[5]);
+}
+
+cv::Mat to_mat(const Affine &t) {
+    cv::Mat m(2, 3, CV_64F);
+    for (int ii = 0; ii < 6; ii ++) m.at<double>(ii / 3, ii % 3) = t[ii];
+    return m;
+}
+
+bool to_motion(const std::string &name, Motion &motion) {
+    if (name == "similarity") motion = Motion::similarity;
+    else if (name == "affine") motion = Motion::affine;
+    else {
+        std::cout << "Error - unrecognized motion model " << yellow << name << res << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+/*
+ * registration.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Star field registration. Star centroids are indexed with a
+ * k-d tree and matched between frames by the shape invariants
+ * of triangles formed with their nearest neighbours. Each
+ * matched triangle proposes a transform, the best of which is 
+ * chosen by RANSAC and refined by least squares over all of 
+ * its inlying stars.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+enum class Motion {similarity, affine};
+
+// Maps (x, y) to (t[0] x + t[1] y + t[2], t[3] x + t[4] y + t[5]), the layout of [cv::warpAffine]
+typedef std::array<double, 6> Affine;
+
+// Static 2D k-d tree over a set of points, stored implicitly as a permutation of their indices
+class KDTree {
+public:
+    KDTree() {}
+    KDTree(const std::vector<std::pair<double, double>> &points);
+
+    std::vector<size_t> nearest(const std::pair<double, double> &p, const size_t k) const;
+    long nearest(const std::pair<double, double> &p, const double radius) const;
+    size_t size() const { return idx.size(); }
+
+private:
+    std::vector<std::pair<double, double>> pts;
+    std::vector<size_t> idx;
+
+    void build(const size_t lo, const size_t hi, const int axis);
+    void search(const std::pair<double, double> &p, const size_t lo, const size_t hi, const int axis,
+                const size_t k, std::vector<std::pair<double, size_t>> &best) const;
+};
+
+// Triangle of stars with vertices ordered opposite the longest, middle and shortest sides,
+// and its similarity invariant side ratios
+struct Triangle {
+    std::array<int, 3> v;
+    std::pair<double, double> shape;
+};
+
+struct StarField {
+    std::vector<std::pair<double, double>> stars;
+    KDTree tree;
+    std::vector<Triangle> triangles;
+    KDTree shapes;
+};
+
+StarField star_field(const cv::Mat &image, const size_t n = 100, const size_t neighbours = 5);
+StarField star_field(const std::vector<std::pair<double, double>> &stars, const size_t neighbours = 5);
+bool register_fields(const StarField &ref, const StarField &com, const Motion motion, Affine &transform,
+                     const double tolerance = 2.0);
+
+bool fit_motion(const std::vector<std::pair<double, double>> &from, const std::vector<std::pair<double, double>> &to, 
+                const Motion motion, Affine &t);
+std::pair<double, double> apply(const Affine &t, const std::pair<double, double> &p);
+cv::Mat to_mat(const Affine &t);
+// Motion model named {name} ("similarity" or "affine"), false (after printing why) if unknown
+bool to_motion(const std::string &name, Motion &motion);
@@ -0,0 +1,214 @@
+/*
+ * skymodel.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Tile-wise least squares modelling of the sky background
+ *
+ */
+
+#include "skymodel.h"
+#include "enhance.h"
+
+cv::Mat sky_model(const cv::Mat &image, const cv::Mat &stars, const size_t size, const int _order, const Surface surface) {
+    Span span("model");
+    const int nb = image.channels();
+    const int order = std::clamp(_order, 0, max_order);
+    const int trows = (image.rows + size - 1) / size;
+    const int tcols = (image.cols + size - 1) / size;
+    std::vector<SkyTile> tiles(trows * tcols);
+
+    // Tiles are independent so they are fitted in parallel
+#pragma omp parallel for schedule(dynamic)
+    for (long t = 0; t < (long)tiles.size(); t ++) {
+        const int r = (t / tcols) * size, c = (t % tcols) * size;
+        const cv::Rect roi(c, r, std::min<int>(size, image.cols - c), std::min<int>(size, image.rows - r));
+        tiles[t] = fit_tile(image, stars, roi, order);
+    }
+    fill_tiles(tiles, trows, tcols, nb);
+
+    // Spline nodes are each tile fit evaluated at its position on the regular grid, which
+    // for the partial tiles along the bottom and right edges is outside the tile itself
+    std::vector<double> nodes(tiles.size() * nb, 0);
+    if (surface == Surface::spline) {
+        for (size_t t = 0; t < tiles.size(); t ++) {
+            const double y = ((t / tcols) + 0.5) * size - 0.5, x = ((t % tcols) + 0.5) * size - 0.5;
+            evaluate(tiles[t], x, y, order, 1, nodes.data() + t * nb);
+        }
+    }
+
+    // Tile centers sit on a regular grid, position {g} in grid units maps to pixel (g + 0.5) * size - 0.5
+    cv::Mat model(image.rows, image.cols, CV_32FC(nb));
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < image.rows; r ++) {
+        const double gy = (r + 0.5) / size - 0.5;
+        const int ty = std::floor(gy);
+        const double fy = gy - ty;
+        float* pixel = model.ptr<float>(r);
+
+        for (int c = 0; c < image.cols; c ++, pixel += nb) {
+            const double gx = (c + 0.5) / size - 0.5;
+            const int tx = std::floor(gx);
+            const double fx = gx - tx;
+
+            double value[4] = {0};
+            if (surface == Surface::polynomial) {
+                // Blend the fits of the four surrounding tiles with bilinear weights, each evaluated 
+                // at this pixel. The weights sum to one so the model is continuous across tiles.
+                for (int dy = 0; dy < 2; dy ++) {
+                    const int ry = std::clamp(ty + dy, 0, trows - 1);
+                    for (int dx = 0; dx < 2; dx ++) {
+                        const int rx = std::clamp(tx + dx, 0, tcols - 1);
+                        const double w = (dy ? fy : 1 - fy) * (dx ? fx : 1 - fx);
+                        evaluate(tiles[ry * tcols + rx], c, r, order, w, value);
+                    }
+                }
+            }
+            else {
+                // Catmull-Rom bicubic spline through the nodes
+                double wy[4], wx[4];
+                for (auto [f, w] : {std::make_pair(fy, wy), std::make_pair(fx, wx)}) {
+                    const double f2 = f * f, f3 = f2 * f;
+                    w[0] = 0.5 * (-f3 + 2 * f2 - f);
+                    w[1] = 0.5 * (3 * f3 - 5 * f2 + 2);
+                    w[2] = 0.5 * (-3 * f3 + 4 * f2 + f);
+                    w[3] = 0.5 * (f3 - f2);
+                }
+                for (int dy = 0; dy < 4; dy ++) {
+                    for (int dx = 0; dx < 4; dx ++) {
+                        for (int b = 0; b < nb; b ++) {
+                            value[b] += wy[dy] * wx[dx] * node(nodes, trows, tcols, nb, ty + dy - 1, tx + dx - 1, b);
+                        }
+                    }
+                }
+            }
+            for (int b = 0; b < nb; b ++) pixel[b] = value[b];
+        }
+    }
+    return model;
+}
+
+SkyTile fit_tile(const cv::Mat &image, const cv::Mat &stars, const cv::Rect &roi, const int order) {
+// Weighted least squares fit of the sky pixels in {roi}. Only the normal equations (X^T X) B = X^T Y 
+// are accumulated, one pixel at a time, so the cost in memory is independent of the tile size.
+    const int nb = image.channels();
+    const int T = nterms(order);
+    SkyTile tile;
+    tile.cx = roi.x + (roi.width - 1) / 2.0;
+    tile.cy = roi.y + (roi.height - 1) / 2.0;
+    tile.scale = std::max(roi.width, roi.height) / 2.0;
+
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(T, T);
+    Eigen::MatrixXd B = Eigen::MatrixXd::Zero(T, nb);
+    std::vector<double> phi(T);
+    size_t n = 0;
+    for (int r = roi.y; r < roi.y + roi.height; r ++) {
+        const uchar* pixel = image.ptr(r) + roi.x * nb;
+        const uchar* star = stars.ptr(r) + roi.x;
+        for (int c = roi.x; c < roi.x + roi.width; c ++, pixel += nb, star ++) {
+            if (*star) continue;
+            basis((c - tile.cx) / tile.scale, (r - tile.cy) / tile.scale, order, phi.data());
+            for (int ii = 0; ii < T; ii ++) {
+                for (int jj = 0; jj <= ii; jj ++) A(ii, jj) += phi[ii] * phi[jj];   // Lower triangle, all LDLT reads
+                for (int b = 0; b < nb; b ++) B(ii, b) += phi[ii] * pixel[b];
+            }
+            n ++;
+        }
+    }
+    if (n < (size_t)T) return tile;
+
+    // Degenerate tiles (e.g. sky pixels along a single line) are left unfitted
+    Eigen::LDLT<Eigen::MatrixXd> ldlt(A);
+    if (ldlt.info() != Eigen::Success || ldlt.rcond() < 1e-10) return tile;
+    tile.coef = ldlt.solve(B);
+    tile.valid = tile.coef.allFinite();
+    return tile;
+}
+
+void fill_tiles(std::vector<SkyTile> &tiles, const int trows, const int tcols, const int nb) {
+// Tiles with too few sky pixels to fit (e.g. covered by a bright star) take the mean constant 
+// term of their fitted neighbours, repeated until every tile is filled
+    bool filled = false;
+    while (!filled) {
+        filled = true;
+        bool changed = false;
+        std::vector<SkyTile> next = tiles;
+        for (int t = 0; t < trows * tcols; t ++) {
+            if (tiles[t].valid) continue;
+            const int ty = t / tcols, tx = t % tcols;
+            Eigen::MatrixXd sum = Eigen::MatrixXd::Zero(1, nb);
+            int count = 0;
+            for (int dy = -1; dy <= 1; dy ++) {
+                for (int dx = -1; dx <= 1; dx ++) {
+                    const int ry = ty + dy, rx = tx + dx;
+                    if (ry < 0 || rx < 0 || ry >= trows || rx >= tcols || !tiles[ry * tcols + rx].valid) continue;
+                    sum += tiles[ry * tcols + rx].coef.row(0);
+                    count ++;
+                }
+            }
+            if (!count) {
+                filled = false;
+                continue;
+            }
+            next[t].coef = sum / count;
+            next[t].valid = changed = true;
+        }
+        tiles.swap(next);
+
+        // No fitted tiles at all, model nothing
+        if (!filled && !changed) {
+            for (auto &tile : tiles) {
+                tile.coef = Eigen::MatrixXd::Zero(1, nb);
+                tile.valid = true;
+            }
+            return;
+        }
+    }
+}
+
+void evaluate(const SkyTile &tile, const double x, const double y, const int order, const double w, double* value) {
+// Add {w} times the fit of {tile} at ({x}, {y}) to {value} for each channel
+    const int nb = tile.coef.cols();
+    if (tile.coef.rows() == 1) {     // Filled tiles only carry a constant term
+        for (int b = 0; b < nb; b ++) value[b] += w * tile.coef(0, b);
+        return;
+    }
+
+    double phi[max_terms];
+    basis((x - tile.cx) / tile.scale, (y - tile.cy) / tile.scale, order, phi);
+    for (int t = 0; t < tile.coef.rows(); t ++) {
+        for (int b = 0; b < nb; b ++) value[b] += w * phi[t] * tile.coef(t, b);
+    }
+}
+
+double node(const std::vector<double> &nodes, const int trows, const int tcols, const int nb, const int ry, const int rx, const int b) {
+// Spline node ({ry}, {rx}), extrapolated linearly past the edges of the grid
+    if (ry < 0 && trows > 1) {
+        const double v0 = node(nodes, trows, tcols, nb, 0, rx, b);
+        return v0 + ry * (node(nodes, trows, tcols, nb, 1, rx, b) - v0);
+    }
+    if (ry >= trows && trows > 1) {
+        const double v1 = node(nodes, trows, tcols, nb, trows - 1, rx, b);
+        return v1 + (ry - trows + 1) * (v1 - node(nodes, trows, tcols, nb, trows - 2, rx, b));
+    }
+    if (rx < 0 && tcols > 1) {
+        const double v0 = node(nodes, trows, tcols, nb, ry, 0, b);
+        return v0 + rx * (node(nodes, trows, tcols, nb, ry, 1, b) - v0);
+    }
+    if (rx >= tcols && tcols > 1) {
+        const double v1 = node(nodes, trows, tcols, nb, ry, tcols - 1, b);
+        return v1 + (rx - tcols + 1) * (v1 - node(nodes, trows, tcols, nb, ry, tcols - 2, b));
+    }
+    return nodes[(std::clamp(ry, 0, trows - 1) * tcols + std::clamp(rx, 0, tcols - 1)) * nb + b];
+}
+
+bool to_surface(const std::string &name, Surface &surface) {
+    if (name == "polynomial") surface = Surface::polynomial;
+    else if (name == "spline") surface = Surface::spline;
+    else {
+        std::cout << "Error - unrecognized surface " << yellow << name << res << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+/*
+ * skymodel.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Light pollution and sky glow modelling. The image is split
+ * into tiles and a low order polynomial surface is fitted to
+ * the sky (non-star) pixels of each tile by least squares,
+ * accumulating the normal equations directly. Neighbouring
+ * tile fits are then blended, or interpolated with a bicubic 
+ * spline, so that no tile seams show in the model.
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <Eigen/Dense>
+
+enum class Surface {polynomial, spline};
+
+// Fit of a single tile, a polynomial in coordinates normalized to [-1, 1] over the tile
+struct SkyTile {
+    bool valid = false;
+    double cx = 0, cy = 0, scale = 1;   // Tile center and half-size
+    Eigen::MatrixXd coef;               // One column of coefficients for each channel
+};
+
+// Model of the sky background of {image} as CV_32F with the same number of channels
+cv::Mat sky_model(const cv::Mat &image, const cv::Mat &stars, const size_t size, 
+                  const int order = 1, const Surface surface = Surface::polynomial);
+
+SkyTile fit_tile(const cv::Mat &image, const cv::Mat &stars, const cv::Rect &roi, const int order);
+void fill_tiles(std::vector<SkyTile> &tiles, const int trows, const int tcols, const int nb);
+double node(const std::vector<double> &nodes, const int trows, const int tcols, const int nb, const int ry, const int rx, const int b);
+void evaluate(const SkyTile &tile, const double x, const double y, const int order, const double w, double* value);
+
+const int max_order = 6;
+const int max_terms = (max_order + 1) * (max_order + 2) / 2;
+
+inline int nterms(const int order) { return (order + 1) * (order + 2) / 2; }
+inline void basis(const double u, const double v, const int order, double* phi) {
+    // Monomials u^i v^j with i + j <= {order}, ordered by total degree so phi[0] is the constant term
+    int t = 0;
+    for (int d = 0; d <= order; d ++) {
+        for (int j = 0; j <= d; j ++) {
+            double p = 1;
+            for (int k = 0; k < d - j; k ++) p *= u;
+            for (int k = 0; k < j; k ++) p *= v;
+            phi[t ++] = p;
+        }
+    }
+}
+// Surface named {name} ("polynomial" or "spline"), false (after printing why) if unknown
+bool to_surface(const std::string &name, Surface &surface);
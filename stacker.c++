@@ -5,11 +5,17 @@
  * Jul 22, 2019
  *
  * Basic deep sky and star stacker which aligns the given images based on
- * the positions of the stars in each image. Images with insufficient 
+ * the positions of the stars in each image (or on ORB features with 
+ * --align features). Images with insufficient 
  * overlap are discarded and foreground is ignored (assuming that it is 
  * darker than the sky). It then coadds the aligned images to produce a 
  * single, higher signal-to-noise, composite image.
  *
+ * Frames flow through a pipeline of decode, feature extraction, matching,
+ * warping and accumulation stages on a work-stealing thread pool. At most
+ * a few frames per thread are in flight so memory use does not grow with
+ * the number of frames stacked.
+ *
  * Possible failure modes - 
  *		 -  Foreground objects are too bright, get detected as stars
  *		 -  Overexposure in the coadded composite from bright clouds
@@ -18,13 +24,30 @@
  
 #include "enhance.h"		// From personal custom image enhancement library
 
-cv::Mat3b key;
+// A frame in flight through the stacking pipeline
+struct Frame {
+	size_t index = 0;
+	bool valid = false;
+	cv::Mat image;
+	StarField field;
+	Features features;
+	cv::Mat transform;			// 2x3 affine (stars) or 3x3 homography (features) onto the keyframe
+};
+
+// Keyframe state, written once before the pipeline starts and only read afterwards
+cv::Mat key;
 std::string keyframe;
-std::vector<cv::Mat> aligned;
-std::atomic<int> complete;
+StarField key_field;
+Features key_features;
+bool by_stars;
+Motion motion;
 std::vector<std::string> images;
+std::vector<cv::Mat> aligned;	// Only kept for --advanced which needs every frame at once
 
-void align(int start, int end);
+void decode_frame(Frame &f);
+void describe_frame(Frame &f);
+void match_frame(Frame &f);
+void warp_frame(Frame &f);
  
 int main(int argn, char** argv) {
 	std::cout << res;
@@ -33,6 +56,8 @@ int main(int argn, char** argv) {
 	int nthreads = max_threads;
 	bool advanced;
 	double threshold = 0;
+	std::string method;
+	std::string model;
 
 	max_features = 10000;
 	good_match_percent = 0.01;
@@ -46,6 +71,10 @@ int main(int argn, char** argv) {
 			("output,o",     po::value<std::string>(&ofile)->default_value(date+".coadd.tif"))
 			("keyframe,k",   po::value<std::string>(&keyframe))
 			("threads,t",    po::value<int>(&nthreads))
+			("align",        po::value<std::string>(&method)->default_value("stars"), "Alignment method, either"
+				" 'stars' (triangle matching of the star field) or 'features' (ORB feature matching).")
+			("motion",       po::value<std::string>(&model)->default_value("similarity"), "Only in effect with"
+				" --align stars, the transform fitted between frames - 'similarity' or 'affine'.")
 			("advanced,a",   po::bool_switch()->default_value(false), "Enable advanced coadding"
 				" (where pixels below a certain brightness are ignored).")
 			("nfeatures,n",  po::value<int>(&max_features), "The maximum number of matches to create")
@@ -77,69 +106,123 @@ int main(int argn, char** argv) {
 		images = vm["images"].as<std::vector<std::string> >();
 	}
 	else {
-        std::cout << description() << std::endl;
+		std::cout << description << std::endl;
 		std::cout << "Error - must specify images to stack" << std::endl;
 		exit(2);
 	}
 	if (!vm.count("keyframe")) keyframe = images[0];
+	if (method != "stars" && method != "features") {
+		std::cout << "Error - unrecognized alignment method " << yellow << method << res << std::endl;
+		exit(3);
+	}
+	by_stars = method == "stars";
+	if (!to_motion(model, motion)) exit(3);
 
-	if (nthreads > images.size()) {
-		nthreads = images.size();
+	if (nthreads > (int)images.size()) nthreads = images.size();
+	if (nthreads < 1) nthreads = 1;
+
+	key = read_image(keyframe);
+	if (key.empty()) exit(4);
+	if (by_stars) key_field = star_field(key);
+	else {
+		std::cout << "{max_features} - " << max_features << std::endl;
+		key_features = describe(key);
 	}
 
-	std::cout << "{max_features} - " << max_features << std::endl;
-	
-	std::cout << "Aligning images... " << std::endl;
-	key = cv::imread(keyframe);
-	int nimages = images.size();
-	int block = nimages / nthreads;
+	// Each stage hands the frame straight on to the next, the last into {done} which is
+	// drained here. No more than {depth} frames are ever in flight.
+	ThreadPool pool(nthreads);
+	const size_t depth = 2 * pool.size();
+	BoundedQueue<Frame> done(depth);
+	Stage<Frame> warp(pool, depth, warp_frame, [&](Frame &&f) { done.push(std::move(f)); });
+	Stage<Frame> match(pool, depth, match_frame, [&](Frame &&f) { warp.push(std::move(f)); });
+	Stage<Frame> features(pool, depth, describe_frame, [&](Frame &&f) { match.push(std::move(f)); });
+	Stage<Frame> decode(pool, depth, decode_frame, [&](Frame &&f) { features.push(std::move(f)); });
 
-	aligned.push_back(key);
-	
-	complete = 0;
-	std::thread threads[nthreads];
-	if (block) {
-		for (int ii = 0; ii < nthreads - 1; ii ++) {
-			threads[ii] = std::thread(align, block * ii, block * (ii + 1));
-		}
-		threads[nthreads - 1] = std::thread(align, block * (nthreads - 1), nimages);
-		
-		int percent = -1;
-		while (complete != nimages) {
-			if (complete * 100 / nimages != percent) {
-				percent = complete * 100 / nimages;
-				print_percent(complete, nimages);
-			}
+	cv::Mat m = cv::Mat::zeros(key.rows, key.cols, CV_64FC(key.channels()));
+	accumulate(key, m);
+	if (advanced) aligned.push_back(key);
+	size_t n = 1;
+	size_t rejected = 0;
+
+	std::cout << "Aligning images... " << std::endl;
+	Progress progress(images.size());
+	const size_t nimages = images.size();
+	size_t submitted = 0;
+	for (size_t received = 0; received < nimages; received ++) {
+		while (submitted < nimages && submitted - received < depth) {
+			Frame f;
+			f.index = submitted ++;
+			decode.push(std::move(f));
 		}
-		
-		for (int ii = 0; ii < nthreads; ii ++) {
-			threads[ii].join();
+		Frame f;
+		done.pop(f);
+		if (f.valid) {
+			accumulate(f.image, m);
+			if (advanced) aligned.push_back(f.image);
+			n ++;
 		}
+		else if (images[f.index] != keyframe) rejected ++;
+		progress.tick();
 	}
-	else {
-		align(0, images.size());
-	}
+	pool.wait();
+	progress.finish();
+	if (rejected) std::cout << yellow << rejected << res << " frames could not be registered and were discarded." << std::endl;
 	
 	if (advanced) {
 		cv::Mat4b coadded;
 		coadded = advanced_coadd(aligned, threshold);
-		cv::imwrite(ofile, coadded);	
+		write_image(ofile, coadded);	
 	}
 	else {
-		cv::Mat3b coadded;
-		coadded = coadd(aligned);
-		cv::imwrite(ofile, coadded);	
+		cv::Mat coadded;
+		m.convertTo(coadded, CV_8U, 1. / n);
+		write_image(ofile, coadded);	
 	}
 }
 
-void align(int start, int end) {
-	cv::Mat3b image, registered;
-	for (int ii = start; ii < end; ii ++) {
-		image = cv::imread(images[ii]);
-		if (images[ii] != keyframe) {
-			align_images(image, key, registered);
-			aligned.push_back(registered);
+void decode_frame(Frame &f) {
+	// The keyframe has already been accumulated
+	f.valid = images[f.index] != keyframe;
+	if (!f.valid) return;
+	f.image = read_image(images[f.index]);
+	f.valid = !f.image.empty();
+}
+
+void describe_frame(Frame &f) {
+	if (!f.valid) return;
+	Quiet quiet;		// Frames are described concurrently, the progress stands in for the status lines
+	if (by_stars) f.field = star_field(f.image);
+	else f.features = describe(f.image);
+}
+
+void match_frame(Frame &f) {
+	if (!f.valid) return;
+	if (by_stars) {
+		Affine t;
+		if (register_fields(key_field, f.field, motion, t)) f.transform = to_mat(t);
+	}
+	else {
+		const std::vector<cv::DMatch> matches = match_features(f.features, key_features);
+		if (draw) {
+			static std::mutex lock;
+			std::lock_guard<std::mutex> guard(lock);
+			cv::Mat drawn;
+			cv::drawMatches(f.image, f.features.keypoints, key, key_features.keypoints, matches, drawn);
+			cv::imwrite("matches.jpg", drawn);
 		}
-		complete++;
-	}	
+		f.transform = homography(f.features, key_features, matches);
+	}
+	f.valid = !f.transform.empty();
+	f.field = StarField();
+	f.features = Features();
+}
+
+void warp_frame(Frame &f) {
+	if (!f.valid) return;
+	Span span("warp");
+	cv::Mat registered;
+	if (by_stars) cv::warpAffine(f.image, registered, f.transform, key.size(), cv::INTER_CUBIC);
+	else cv::warpPerspective(f.image, registered, f.transform, key.size());
+	f.image = registered;
 }
@@ -0,0 +1,352 @@
+/*
+ * stages.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the pipeline stages, their configuration
+ * and the fused runner.
+ *
+ */
+
+#include "stages.h"
+#include "enhance.h"
+
+std::string StageSpec::get(const std::string &key, const std::string &fallback) const {
+    const auto it = options.find(key);
+    return it == options.end() ? fallback : it->second;
+}
+
+double StageSpec::number(const std::string &key, const double fallback) const {
+    const auto it = options.find(key);
+    if (it == options.end()) return fallback;
+    try {
+        return std::stod(it->second);
+    }
+    catch (...) {
+        std::cout << yellow << "Warning" << res << " - " << name << " option " << key << "=" << it->second
+                  << " is not a number, using " << fallback << std::endl;
+        return fallback;
+    }
+}
+
+std::vector<std::string> StageSpec::list(const std::string &key) const {
+    std::vector<std::string> items;
+    std::stringstream ss(get(key));
+    std::string item;
+    while (std::getline(ss, item, ',')) if (!item.empty()) items.push_back(item);
+    return items;
+}
+
+StageSpec parse_stage(const std::string &line) {
+    StageSpec spec;
+    std::stringstream ss(line.substr(0, line.find('#')));
+    std::string token;
+    ss >> spec.name;
+    while (ss >> token) {
+        const size_t eq = token.find('=');
+        if (eq == std::string::npos) spec.options[token] = "1";          // Bare flags, e.g. "normalize"
+        else spec.options[token.substr(0, eq)] = token.substr(eq + 1);
+    }
+    return spec;
+}
+
+std::vector<StageSpec> parse_stages(std::istream &in) {
+    std::vector<StageSpec> specs;
+    std::string line;
+    while (std::getline(in, line)) {
+        StageSpec spec = parse_stage(line);
+        if (!spec.name.empty()) specs.push_back(spec);
+    }
+    return specs;
+}
+
+// The options each stage accepts, and whether it is a frame (true) or a stack (false) stage
+static const std::map<std::string, std::pair<bool, std::vector<std::string>>> stage_options = {
+    {"calibrate",     {true,  {"cache", "exposure", "dark_exposure", "iso", "temperature", "bias", "darks", "flats", "kappa"}}},
+    {"median_filter", {true,  {"mode", "kernel", "strength", "normalize", "stretch"}}},
+    {"depollute",     {true,  {"scale", "z", "detection", "order", "surface"}}},
+    {"align",         {true,  {"by", "motion", "keyframe"}}},
+    {"coadd",         {false, {"mode", "kappa", "iterations", "output", "memory", "scratch"}}},
+    {"startrails",    {false, {"threshold", "output"}}},
+    {"save",          {false, {"output"}}},
+};
+
+// Shared by the align stage and [Pipeline::prepare_alignment], which fills it in before the run
+struct KeyFrame {
+    bool by_stars = true;
+    Motion motion = Motion::similarity;
+    std::string file;
+    cv::Size size;
+    StarField field;
+    Features features;
+};
+
+class CoaddStage : public StackStage {
+public:
+    CoaddStage(const StageSpec &spec) : mode(to_reduction(spec.get("mode", "mean"))), kappa(spec.number("kappa", 2.5)),
+                                        iters(spec.number("iterations", 5)), output(spec.get("output", "./coadded.tif")),
+                                        budget((size_t)spec.number("memory", 4096) << 20) {
+        if (mode != Reduction::mean) stack.reset(new ScratchStack(spec.get("scratch")));
+    }
+
+    void add(const cv::Mat &frame) override {
+        if (n && (frame.size() != size || frame.channels() != channels)) {
+            std::cout << "Error, shape mismatch on frame with shape " << frame.rows << "x" << frame.cols;
+            std::cout << " expected " << size.height << "x" << size.width << ", skipping." << std::endl;
+            return;
+        }
+        // The mean is accumulated as frames arrive, the other reductions spool the frames to a
+        // scratch stack on disk and reduce it within {budget} at the end, as [stream_reduce] does
+        if (mode == Reduction::mean) {
+            if (sum.empty()) sum = cv::Mat::zeros(frame.rows, frame.cols, CV_64FC(frame.channels()));
+            accumulate(frame, sum);
+        }
+        else if (!stack->add(frame)) return;
+        size = frame.size();
+        channels = frame.channels();
+        n ++;
+    }
+    void finish() override {
+        if (!n) return;
+        cv::Mat out;
+        if (mode == Reduction::mean) sum.convertTo(out, CV_8U, 1. / n);
+        else out = stack->reduce(budget, mode, kappa, iters);
+        if (!out.empty()) write_image(output, out);
+    }
+
+private:
+    const Reduction mode;
+    const double kappa;
+    const size_t iters;
+    const std::string output;
+    const size_t budget;                // Bytes of image data held when reducing the scratch stack
+    cv::Mat sum;                        // Running sum for the mean
+    std::unique_ptr<ScratchStack> stack;
+    cv::Size size;
+    int channels = 0;
+    size_t n = 0;
+};
+
+class TrailStage : public StackStage {
+public:
+    TrailStage(const StageSpec &spec) : trails(spec.number("threshold", 0)), output(spec.get("output", "./composite.tif")) {}
+
+    void add(const cv::Mat &frame) override { trails.add(frame); }
+    void finish() override {
+        if (trails.count()) write_image(output, trails.composite());
+    }
+
+private:
+    StarTrail trails;
+    const std::string output;
+};
+
+class SaveStage : public StackStage {
+public:
+    SaveStage(const StageSpec &spec) : path(spec.get("output", "./frame.tif")) {}
+
+    // Frames are numbered from 1 after {path}'s stem, e.g. frame.tif gives frame_00001.tif, ...
+    void add(const cv::Mat &frame) override {
+        std::stringstream name;
+        name << path.stem().string() << "_" << std::setw(5) << std::setfill('0') << ++written << path.extension().string();
+        write_image((path.parent_path() / name.str()).string(), frame);
+    }
+    void finish() override {}
+
+private:
+    const fs::path path;
+    size_t written = 0;
+};
+
+bool Pipeline::configure(const std::vector<StageSpec> &specs) {
+    frame_stages.clear();
+    stack_stages.clear();
+    align = -1;
+
+    for (const auto &spec : specs) {
+        const auto known = stage_options.find(spec.name);
+        if (known == stage_options.end()) {
+            std::cout << "Error - unknown stage " << yellow << spec.name << res << std::endl;
+            return false;
+        }
+        for (const auto &option : spec.options) {
+            const auto &accepted = known->second.second;
+            if (std::find(accepted.begin(), accepted.end(), option.first) == accepted.end()) {
+                std::cout << yellow << "Warning" << res << " - " << spec.name << " has no option " << option.first << ", ignoring it." << std::endl;
+            }
+        }
+        if (known->second.first && !stack_stages.empty()) {
+            std::cout << "Error - frame stage " << yellow << spec.name << res << " follows a stack stage." << std::endl;
+            return false;
+        }
+
+        if (spec.name == "calibrate") {
+            // As the subtract routine, new calibration frames replace the cached masters
+            CalibrationKey key;
+            key.exposure = spec.number("dark_exposure", 0);
+            key.iso = spec.number("iso", 0);
+            key.temperature = spec.number("temperature", 0);
+            const std::string cache = spec.get("cache", "./.calibration");
+            const auto bias = spec.list("bias"), darks = spec.list("darks"), flats = spec.list("flats");
+
+            auto cal = std::make_shared<Calibration>();
+            if (bias.empty() && darks.empty() && flats.empty()) {
+                *cal = load_masters(key, cache);
+                if (cal->empty()) {
+                    std::cout << "Error - no calibration frames given and no cached masters for " << yellow << key.name() << res << std::endl;
+                    return false;
+                }
+            }
+            else {
+                *cal = build_masters(bias, darks, flats, key, spec.number("kappa", 3.0));
+                if (cal->empty()) return false;
+                save_masters(*cal, cache);
+            }
+            const double exposure = spec.number("exposure", 0);
+            frame_stages.push_back([cal, exposure](const cv::Mat &frame) { return calibrate(frame, *cal, exposure); });
+        }
+        else if (spec.name == "median_filter") {
+            const std::string mode = spec.get("mode", "local");
+            FilterMode fmode;
+            if (mode == "global") fmode = FilterMode::global;
+            else if (mode == "row") fmode = FilterMode::row;
+            else if (mode == "col") fmode = FilterMode::col;
+            else if (mode == "rowcol") fmode = FilterMode::rowcol;
+            else if (mode == "colrow") fmode = FilterMode::colrow;
+            else if (mode == "local") fmode = FilterMode::local;
+            else {
+                std::cout << "Error - unknown filtering mode " << yellow << mode << res << "." << std::endl;
+                return false;
+            }
+            const size_t kernel = spec.number("kernel", fmode == FilterMode::local ? 256 : 10);
+            const double strength = spec.number("strength", 0.8);
+            const bool norm = spec.number("normalize", 0), stretch = spec.number("stretch", 0);
+            frame_stages.push_back([=](const cv::Mat &frame) {
+                return median_filter(frame, fmode, norm, stretch, kernel, 0, 0, strength);
+            });
+        }
+        else if (spec.name == "depollute") {
+            const size_t scale = spec.number("scale", 10), z = spec.number("z", 8);
+            const std::string detection = spec.get("detection", "gaussian");
+            if (detection != "gaussian" && detection != "brightness") {
+                std::cout << "Error - unknown depollute detection " << yellow << detection << res << std::endl;
+                return false;
+            }
+            const FindBy find = detection == "brightness" ? FindBy::brightness : FindBy::gaussian;
+            const int order = spec.number("order", 1);
+            Surface surface;
+            if (!to_surface(spec.get("surface", "polynomial"), surface)) return false;
+            frame_stages.push_back([=](const cv::Mat &frame) {
+                cv::Mat image = frame.clone();
+                depollute(image, scale, z, find, order, surface);
+                return image;
+            });
+        }
+        else if (spec.name == "align") {
+            if (align >= 0) {
+                std::cout << "Error - only one align stage is allowed." << std::endl;
+                return false;
+            }
+            auto key = std::make_shared<KeyFrame>();
+            const std::string by = spec.get("by", "stars");
+            if (by != "stars" && by != "features") {
+                std::cout << "Error - unknown align method " << yellow << by << res << std::endl;
+                return false;
+            }
+            key->by_stars = by == "stars";
+            if (!to_motion(spec.get("motion", "similarity"), key->motion)) return false;
+            key->file = spec.get("keyframe");
+            this->key = key;
+            align = frame_stages.size();
+
+            // Frames which cannot be registered are dropped
+            frame_stages.push_back([key](const cv::Mat &frame) {
+                cv::Mat com = frame, registered;
+                if (key->by_stars) {
+                    if (!align_stars(key->field, key->size, com, registered, key->motion)) return cv::Mat();
+                }
+                else {
+                    const Features f = describe(com);
+                    const cv::Mat h = homography(f, key->features, match_features(f, key->features));
+                    if (h.empty()) return cv::Mat();
+                    Span span("warp");
+                    cv::warpPerspective(com, registered, h, key->size);
+                }
+                return registered;
+            });
+        }
+        else if (spec.name == "coadd") {
+            const std::string mode = spec.get("mode", "mean");
+            if (mode != "mean" && mode != "average" && mode != "median" && mode != "sigma" && mode != "winsor") {
+                std::cout << "Error - unknown coadd mode " << yellow << mode << res << std::endl;
+                return false;
+            }
+            stack_stages.emplace_back(new CoaddStage(spec));
+        }
+        else if (spec.name == "startrails") stack_stages.emplace_back(new TrailStage(spec));
+        else if (spec.name == "save") stack_stages.emplace_back(new SaveStage(spec));
+    }
+    if (stack_stages.empty()) {
+        std::cout << "Error - the pipeline has no stack or save stage, so nothing would be written." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Pipeline::prepare_alignment(FrameSource &source) {
+    // The key frame goes through the same stages as every other frame up to the alignment
+    cv::Mat frame;
+    if (!key->file.empty()) frame = read_image(key->file);
+    else if (source.next(frame)) {
+        frame = frame.clone();
+        source.rewind();
+    }
+    if (frame.empty()) {
+        std::cout << "Error - could not read the key frame." << std::endl;
+        return false;
+    }
+    for (long ii = 0; ii < align && !frame.empty(); ii ++) frame = frame_stages[ii](frame);
+    if (frame.empty()) {
+        std::cout << "Error - the key frame was dropped before the align stage." << std::endl;
+        return false;
+    }
+
+    key->size = frame.size();
+    if (key->by_stars) key->field = star_field(frame);
+    else key->features = describe(frame);
+    return true;
+}
+
+size_t Pipeline::run(FrameSource &source, const size_t threads) {
+    if (align >= 0 && !prepare_alignment(source)) return 0;
+
+    // Frames are processed concurrently on the workers of [map_frames], whose pool gives each
+    // worker's own parallel loops an equal share of the cores. The stages' own status lines are
+    // quieted, the run's progress and the count of dropped frames stand in for them.
+    const auto process = [&](const cv::Mat &_frame) {
+        Quiet quiet;
+        cv::Mat frame = _frame;
+        for (size_t ii = 0; ii < frame_stages.size() && !frame.empty(); ii ++) frame = frame_stages[ii](frame);
+        return frame;
+    };
+
+    size_t n = 0, dropped = 0;
+    std::cout << "Running " << frame_stages.size() << " frame and " << stack_stages.size() << " stack stages..." << std::endl;
+    Progress progress(source.size());
+    map_frames(source, process, [&](const cv::Mat &frame) {
+        progress.tick();
+        if (frame.empty()) {
+            dropped ++;
+            return;
+        }
+        for (auto &stage : stack_stages) stage->add(frame);
+        n ++;
+    }, threads);
+    progress.finish();
+    std::cout << magenta << n << res << " frames reached the stack stages." << std::endl;
+    if (dropped) std::cout << yellow << dropped << res << " frames were dropped (unreadable or could not be registered)." << std::endl;
+
+    for (auto &stage : stack_stages) stage->finish();
+    return n;
+}
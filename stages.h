@@ -0,0 +1,86 @@
+/*
+ * stages.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Declarative processing pipelines. A pipeline is a list of
+ * stages, one per line of a config file or command line
+ * argument, each a stage name followed by key=value options,
+ * e.g.
+ *
+ *    calibrate cache=./.calibration exposure=30 dark_exposure=30 iso=800
+ *    median_filter mode=local kernel=256
+ *    depollute scale=64 order=1
+ *    align by=stars
+ *    coadd mode=sigma output=stacked.tif
+ *    startrails output=trails.tif
+ *
+ * Frame stages (calibrate, median_filter, depollute, align)
+ * are fused into one function applied to each frame in 
+ * memory, concurrently across frames. Stack stages (coadd,
+ * startrails, save) then consume the frames in order, coadd
+ * and startrails writing their results once every frame has
+ * been seen. Nothing is written between stages, only a save
+ * stage writes the processed frames themselves.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "video.h"
+
+struct StageSpec {
+    std::string name;
+    std::map<std::string, std::string> options;
+
+    // Value of option {key}, {fallback} if it was not given
+    std::string get(const std::string &key, const std::string &fallback = "") const;
+    double number(const std::string &key, const double fallback) const;
+    std::vector<std::string> list(const std::string &key) const;     // Comma separated
+};
+
+// One stage from "name key=value ...", an empty name for blank or comment (#) lines
+StageSpec parse_stage(const std::string &line);
+std::vector<StageSpec> parse_stages(std::istream &in);
+
+// Transforms a single frame, returning an empty frame to drop it from the stack stages. Must be
+// safe to call from several threads at once.
+using FrameStage = std::function<cv::Mat(const cv::Mat&)>;
+
+// Consumes every frame in order and writes its result at [finish]
+class StackStage {
+public:
+    virtual ~StackStage() {}
+    virtual void add(const cv::Mat &frame) = 0;
+    virtual void finish() = 0;
+};
+
+struct KeyFrame;
+
+class Pipeline {
+public:
+    // False (after printing why) if any stage is unknown, misconfigured or out of order
+    bool configure(const std::vector<StageSpec> &specs);
+
+    // Stream every frame of {source} through the frame stages on {threads} workers and into the
+    // stack stages, returning the number of frames which reached the stack stages
+    size_t run(FrameSource &source, const size_t threads);
+
+private:
+    bool prepare_alignment(FrameSource &source);
+
+    std::vector<FrameStage> frame_stages;
+    std::vector<std::unique_ptr<StackStage>> stack_stages;
+    long align = -1;                    // Index of the align stage in {frame_stages}, -1 if none
+    std::shared_ptr<KeyFrame> key;
+};
@@ -1,3 +1,18 @@
+/*
+ * startrails.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Star trail composites from image sequences or video files,
+ * accumulated in a single streaming pass with optional growing
+ * trail timelapse output.
+ *
+ * Usage: startrails -i <files> [-m frames|video] [-t threshold]
+ *                   [-e every -l timelapse [--fps fps]]
+ *
+ */
+
 
 #include "enhance.h"
 
@@ -5,7 +20,10 @@
 int main(int argn, char** argv) {
 	std::vector<std::string> files;
     std::string mode;
+    std::string timelapse;
     uint threshold; 
+    size_t every;
+    double fps;
 
    	po::options_description description("Usage");
 	try {
@@ -17,6 +35,12 @@ int main(int argn, char** argv) {
 			("threshold,t", po::value<uint>(&threshold)->default_value(0), "The brightness threshold below which pixels will use the " 
 			                                                               "mean value instead of lightest value during accumulation "
 			                                                               "[0-255]. Optional.")
+			("every,e", po::value<size_t>(&every)->default_value(0), "Write the running composite every {every} frames to the "
+			                                                         "--timelapse output, growing the trails as it goes. Optional.")
+			("timelapse,l", po::value<std::string>(&timelapse), "Output for the running composites - a video if the extension is "
+			                                                    "one of .mp4, .avi, .mkv or .mov, otherwise a numbered image sequence "
+			                                                    "(e.g. trails.tif gives trails_00001.tif, ...). Optional.")
+			("fps", po::value<double>(&fps)->default_value(24), "Frame rate of a --timelapse video. Optional.")
 		;
 	}
 	catch (...) {
@@ -40,18 +64,33 @@ int main(int argn, char** argv) {
    		exit(2);
 	}
 
-	if (mode == "frames") {	
-		std::vector<cv::Mat> images = read_images(files);
-		cv::Mat star_trails = star_trail(images, threshold);
-		imwrite("./composite.tif", star_trails);
-	}
-	else if (mode == "video") {
-		std::vector<cv::Mat> frames = extract_frames(files);
-		cv::Mat star_trails = star_trail(frames, threshold);
+	// Both modes stream their frames so that arbitrarily long sequences run in constant memory
+	std::unique_ptr<FrameSource> source;
+	if (mode == "frames") source.reset(new ImageSource(files));
+	else if (mode == "video") source.reset(new VideoSource(files));
+	if (source) {
+		// Running composites go either to a video or to a numbered image sequence
+		cv::VideoWriter writer;
+		size_t written = 0;
+		const fs::path path(timelapse);
+		const std::string ext = path.extension().string();
+		const bool video = ext == ".mp4" || ext == ".avi" || ext == ".mkv" || ext == ".mov";
+		const auto emit = [&](const cv::Mat &composite) {
+			if (video) {
+				if (!writer.isOpened()) writer.open(timelapse, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, composite.size());
+				writer << composite;
+			}
+			else {
+				std::stringstream name;
+				name << path.stem().string() << "_" << std::setw(5) << std::setfill('0') << ++written << ext;
+				write_image((path.parent_path() / name.str()).string(), composite);
+			}
+		};
+
+		cv::Mat star_trails = star_trail(*source, threshold, timelapse.empty() ? 0 : every, emit);
+		writer.release();
 		std::cout << green+bright+" done"+res+"." << std::endl;
-		star_trails.convertTo(star_trails, CV_8UC3);
-		imshow("Image", star_trails);
-		imwrite("./composite.tif", star_trails);
+		write_image("./composite.tif", star_trails);
 	}
 	else {
 		std::cout << red << "Mode must be specified" << res << std::endl;
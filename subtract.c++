@@ -4,30 +4,54 @@
  * William Miller
  * Jun 29, 2020
  *
- * Basic image subtraction, mainly for masking off
- * sensor noise and hot pixels by subtracting a 
- * 'dark frame' (i.e. an exposure of same ISO and
- * duration taken at the same ambient temperature
- * around the same time as the primary exposure).
+ * Calibration of light frames - bias subtraction, dark 
+ * subtraction scaled to the light's exposure, flat field 
+ * division and hot pixel repair in one pass per frame.
+ *
+ * Masters are built from --bias, --darks and --flats by 
+ * sigma clipped stacking and cached (keyed by the darks'
+ * exposure, ISO and temperature) so that later runs with 
+ * the same key only need the lights. A single dark frame
+ * can still be subtracted directly with --dark-frame.
  * 
  * Usage:
  * 
- *    subtract [-i|--images] <files> [-d|--dark-frame] <dark-frame>
+ *    subtract [-i|--images] <files> [-d|--dark-frame] <dark-frame> [-f|--factor] <factor>
+ *    subtract [-i|--images] <files> [--bias <files>] [--darks <files>] [--flats <files>]
+ *             [-e|--exposure] <seconds> [--dark-exposure <seconds>] [--iso <iso>] 
+ *             [--temperature <celsius>] [--cache <dir>]
  */
 
 #include "enhance.h"
 
 int main(int argn, char** argv) {
 	std::vector<std::string> files;
+	std::vector<std::string> bias;
+	std::vector<std::string> darks;
+	std::vector<std::string> flats;
 	std::string darkframe;
+	std::string cache;
 	double factor;
+	double exposure;
+	double kappa;
+	CalibrationKey key;
 
 	po::options_description description("Usage");
 	try {
 		description.add_options()
-			("images,i", po::value<std::vector<std::string> >()->multitoken(), "The images to coadd.")
-			("dark-frame,d", po::value<std::string>(&darkframe), "The dark frame to subtract off.")
-			("factor,f", po::value<double>(&factor), "Multiplication factor for dark frame subtraction.")
+			("images,i", po::value<std::vector<std::string> >()->multitoken(), "The light frames to calibrate.")
+			("dark-frame,d", po::value<std::string>(&darkframe), "A single dark frame to subtract off.")
+			("factor,f", po::value<double>(&factor)->default_value(1.0), "Multiplication factor for single dark frame subtraction.")
+			("bias", po::value<std::vector<std::string> >()->multitoken(), "Bias frames to build the master bias from.")
+			("darks", po::value<std::vector<std::string> >()->multitoken(), "Dark frames to build the master dark from.")
+			("flats", po::value<std::vector<std::string> >()->multitoken(), "Flat frames to build the master flat from.")
+			("exposure,e", po::value<double>(&exposure)->default_value(0), "Exposure of the lights in seconds, the master dark "
+				"is scaled by the ratio to --dark-exposure (unscaled if either is 0).")
+			("dark-exposure", po::value<double>(&key.exposure)->default_value(0), "Exposure of the darks in seconds.")
+			("iso", po::value<int>(&key.iso)->default_value(0), "ISO of the darks and lights.")
+			("temperature", po::value<double>(&key.temperature)->default_value(0), "Sensor or ambient temperature of the darks.")
+			("cache", po::value<std::string>(&cache)->default_value("./.calibration"), "Directory of cached masters.")
+			("kappa,k", po::value<double>(&kappa)->default_value(3.0), "Rejection threshold in standard deviations when stacking masters.")
 		;
 	}
 	catch (...) {
@@ -45,10 +69,29 @@ int main(int argn, char** argv) {
 		exit(2);
 	}
 
-	if (!vm.count("dark-frame")) {
-		std::cout << "Error - must specify image to subtract off (i.e. the dark frame)" << std::endl;
-		exit(3);
+	if (vm.count("dark-frame")) {
+		subtract(files, darkframe, factor);
+		return 0;
 	}
 
-	subtract(files, darkframe, factor);
+	if (vm.count("bias")) bias = vm["bias"].as<std::vector<std::string> >();
+	if (vm.count("darks")) darks = vm["darks"].as<std::vector<std::string> >();
+	if (vm.count("flats")) flats = vm["flats"].as<std::vector<std::string> >();
+
+	// New calibration frames replace the cached masters for this key, otherwise reuse them
+	Calibration cal;
+	if (bias.empty() && darks.empty() && flats.empty()) {
+		cal = load_masters(key, cache);
+		if (cal.empty()) {
+			std::cout << "Error - no calibration frames given and no cached masters for " << yellow << key.name() << res << std::endl;
+			exit(3);
+		}
+		std::cout << "Using cached masters for " << yellow << key.name() << res << std::endl;
+	}
+	else {
+		cal = build_masters(bias, darks, flats, key, kappa);
+		if (cal.empty()) exit(4);
+		save_masters(cal, cache);
+	}
+	calibrate_files(files, cal, exposure);
 }
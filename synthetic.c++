@@ -0,0 +1,107 @@
+/*
+ * synthetic.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the synthetic star field generator.
+ *
+ */
+
+#include "synthetic.h"
+#include "enhance.h"
+
+// SplitMix64, used to derive independent seeds so that every frame (and every row of the noise)
+// is reproducible regardless of the order or thread it is generated on
+static uint64_t _mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+cv::Mat synthetic_frame(const FieldSpec &spec, const size_t index) {
+    const int w = spec.width, h = spec.height;
+    std::vector<float> field((size_t)w * h * 3);
+
+    // Sky gradient from the top left to the bottom right corner, slightly blue
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < h; r ++) {
+        float* p = field.data() + (size_t)r * w * 3;
+        for (int c = 0; c < w; c ++) {
+            const float sky = spec.sky + spec.gradient * (c / (double)w + r / (double)h) / 2;
+            p[3 * c] = sky * 1.1f;
+            p[3 * c + 1] = sky;
+            p[3 * c + 2] = sky * 0.9f;
+        }
+    }
+
+    // Stars are placed over a margin around the frame so that drift and rotation bring new
+    // stars in rather than leaving the edges empty. Every frame draws the same stars.
+    std::mt19937_64 stars(_mix(spec.seed));
+    std::uniform_real_distribution<double> U(0, 1);
+    const double cx = w / 2., cy = h / 2.;
+    const double theta = spec.rotation * index;
+    const double ct = std::cos(theta), st = std::sin(theta);
+    const double dx = spec.drift * index, dy = spec.drift * index / 2;
+    for (size_t s = 0; s < spec.stars; s ++) {
+        const double x0 = (U(stars) * 1.2 - 0.1) * w;
+        const double y0 = (U(stars) * 1.2 - 0.1) * h;
+        const double peak = 15 + 240 * std::pow(U(stars), 6);
+        const double sigma = 0.7 + 1.3 * peak / 255;
+        const double tint = 0.85 + 0.3 * U(stars);
+
+        const double x = cx + ct * (x0 - cx) - st * (y0 - cy) + dx;
+        const double y = cy + st * (x0 - cx) + ct * (y0 - cy) + dy;
+        const int radius = std::ceil(4 * sigma);
+        for (int r = std::max(0, (int)y - radius); r <= std::min(h - 1, (int)y + radius); r ++) {
+            for (int c = std::max(0, (int)x - radius); c <= std::min(w - 1, (int)x + radius); c ++) {
+                const double v = peak * std::exp(-((c - x) * (c - x) + (r - y) * (r - y)) / (2 * sigma * sigma));
+                float* p = field.data() + ((size_t)r * w + c) * 3;
+                p[0] += v * tint;
+                p[1] += v;
+                p[2] += v / tint;
+            }
+        }
+    }
+
+    // Satellite trail, a straight line between two random points on the frame edges
+    std::mt19937_64 frame(_mix(spec.seed ^ _mix(index + 1)));
+    if (U(frame) < spec.trails) {
+        const double x0 = 0, y0 = U(frame) * h, x1 = w - 1, y1 = U(frame) * h;
+        const double len = std::hypot(x1 - x0, y1 - y0);
+        for (double t = 0; t <= len; t += 0.5) {
+            const double x = x0 + (x1 - x0) * t / len, y = y0 + (y1 - y0) * t / len;
+            for (int r = std::max(0, (int)y - 1); r <= std::min(h - 1, (int)y + 1); r ++) {
+                float* p = field.data() + ((size_t)r * w + (int)x) * 3;
+                const float v = 60 * std::exp(-(r - y) * (r - y));
+                for (int k = 0; k < 3; k ++) p[k] = std::max(p[k], (float)(spec.sky + v));
+            }
+        }
+    }
+
+    // Read noise, seeded per row, then quantize
+    cv::Mat out(h, w, CV_8UC3);
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < h; r ++) {
+        std::mt19937 rng(_mix(spec.seed ^ _mix((index << 32) + r + 1)));
+        std::normal_distribution<float> N(0, spec.noise);
+        const float* p = field.data() + (size_t)r * w * 3;
+        uchar* o = out.ptr(r);
+        for (int e = 0; e < w * 3; e ++) o[e] = cv::saturate_cast<uchar>(p[e] + (spec.noise > 0 ? N(rng) : 0));
+    }
+
+    // Hot pixels are fixed to the sensor, so they do not move with the stars
+    std::mt19937_64 hot(_mix(spec.seed + 1));
+    for (size_t ii = 0; ii < spec.hot; ii ++) {
+        const int r = hot() % h, c = hot() % w;
+        out.at<cv::Vec3b>(r, c) = cv::Vec3b(255, 255, 255);
+    }
+    return out;
+}
+
+std::vector<cv::Mat> synthetic_frames(const FieldSpec &spec) {
+    std::vector<cv::Mat> frames(spec.frames);
+    for (size_t ii = 0; ii < spec.frames; ii ++) frames[ii] = synthetic_frame(spec, ii);
+    return frames;
+}
@@ -0,0 +1,38 @@
+/*
+ * synthetic.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Deterministic synthetic star fields for benchmarking -
+ * Gaussian stars drifting and rotating between frames over
+ * a sky gradient, with fixed hot pixels, read noise and
+ * occasional satellite trails.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+struct FieldSpec {
+    int width = 1920;
+    int height = 1080;
+    size_t frames = 16;
+    size_t stars = 2000;
+    size_t hot = 200;               // Hot pixels, at the same place in every frame
+    double gradient = 40;           // Sky brightness change corner to corner
+    double sky = 20;                // Sky brightness at the darkest corner
+    double noise = 3;               // Read noise standard deviation
+    double drift = 1.5;             // Pixels per frame
+    double rotation = 2e-4;         // Radians per frame, about the centre
+    double trails = 0.25;           // Probability of a satellite trail in each frame
+    uint64_t seed = 1;
+};
+
+// Frame {index} of the sequence described by {spec} (CV_8UC3), the same for the same spec and index
+cv::Mat synthetic_frame(const FieldSpec &spec, const size_t index);
+std::vector<cv::Mat> synthetic_frames(const FieldSpec &spec);
@@ -0,0 +1,188 @@
+/*
+ * telemetry.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the counters, progress reporter and span
+ * tracing.
+ *
+ */
+
+#include "telemetry.h"
+#include "enhance.h"
+
+void Counter::add(const size_t n) {
+    // Threads take slots round robin on first use, so up to {counter_slots} threads never contend
+    static std::atomic<size_t> next(0);
+    thread_local const size_t slot = next++ % counter_slots;
+    slots[slot].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+size_t Counter::total() const {
+    size_t sum = 0;
+    for (const auto &s : slots) sum += s.value.load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Counter::reset() {
+    for (auto &s : slots) s.value.store(0, std::memory_order_relaxed);
+}
+
+Progress::Progress(const size_t total, const std::chrono::milliseconds interval) : total(total), interval(interval) {
+    if (isatty(STDOUT_FILENO)) draw(0);
+    reporter = std::thread(&Progress::report, this);
+}
+
+Progress::~Progress() {
+    finish();
+}
+
+void Progress::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (finished) return;
+        finished = true;
+    }
+    cv.notify_one();
+    reporter.join();
+    draw(total);
+}
+
+void Progress::report() {
+    const bool tty = isatty(STDOUT_FILENO);
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!cv.wait_for(lock, interval, [this] { return finished; })) {
+        if (tty) draw(std::min(counter.total(), total));
+    }
+}
+
+void Progress::draw(const size_t done) {
+    // [print_percent] draws current / (total - 1), so a total of 101 draws the percentage itself.
+    // As with [print_percent], a single unit of work is not worth reporting.
+    if (total <= 1) return;
+    const int percent = done * 100 / total;
+    if (percent == drawn) return;
+    drawn = percent;
+    print_percent(percent, 101);
+}
+
+struct SpanEvent {
+    const char* name;
+    int64_t start;
+    int64_t end;
+};
+
+// Each thread appends to its own buffer, the lock is only ever contended while a trace is written
+struct ThreadTrace {
+    std::mutex mtx;
+    size_t tid;
+    std::vector<SpanEvent> events;
+};
+
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+static std::atomic<bool> tracing(false);
+static std::string trace_file;
+static std::mutex registry_mtx;
+// Shared with the threads so that buffers outlive pool threads which exit before the trace is written
+static std::vector<std::shared_ptr<ThreadTrace>> registry;
+
+static int64_t _now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static ThreadTrace& _thread_trace() {
+    thread_local const std::shared_ptr<ThreadTrace> trace = [] {
+        auto t = std::make_shared<ThreadTrace>();
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        t->tid = registry.size();
+        registry.push_back(t);
+        return t;
+    }();
+    return *trace;
+}
+
+static thread_local bool quieted = false;
+
+Quiet::Quiet() : was(quieted) { quieted = true; }
+Quiet::~Quiet() { quieted = was; }
+
+bool quiet() { return quieted; }
+
+Span::Span(const char* name) : name(name) {
+    if (tracing.load(std::memory_order_relaxed)) start = _now();
+}
+
+Span::~Span() {
+    if (start < 0) return;
+    const int64_t end = _now();
+    ThreadTrace &trace = _thread_trace();
+    std::lock_guard<std::mutex> lock(trace.mtx);
+    trace.events.push_back({name, start, end});
+}
+
+void enable_trace(const std::string &file) {
+    trace_file = file;
+    tracing = true;
+}
+
+bool trace_enabled() { return tracing; }
+
+bool write_trace(const std::string &file) {
+    std::ofstream out(file);
+    if (!out) {
+        std::cout << "Error - could not write trace to " << yellow << file << res << std::endl;
+        return false;
+    }
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    std::lock_guard<std::mutex> registry_lock(registry_mtx);
+    for (const auto &trace : registry) {
+        std::lock_guard<std::mutex> lock(trace->mtx);
+        for (const auto &e : trace->events) {
+            out << (first ? "" : ",\n") << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": " << getpid()
+                << ", \"tid\": " << trace->tid << ", \"ts\": " << e.start << ", \"dur\": " << e.end - e.start << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return true;
+}
+
+void print_trace_summary() {
+    // Totals are summed over threads, so parallel stages can exceed the wall time
+    std::map<std::string, std::pair<int64_t, size_t>> totals;
+    {
+        std::lock_guard<std::mutex> registry_lock(registry_mtx);
+        for (const auto &trace : registry) {
+            std::lock_guard<std::mutex> lock(trace->mtx);
+            for (const auto &e : trace->events) {
+                auto &t = totals[e.name];
+                t.first += e.end - e.start;
+                t.second ++;
+            }
+        }
+    }
+    std::vector<std::pair<std::string, std::pair<int64_t, size_t>>> sorted(totals.begin(), totals.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second.first > b.second.first; });
+
+    std::cout << "Wall time " << std::fixed << std::setprecision(3) << _now() / 1e6 << " s, stage times summed over threads:" << std::endl;
+    std::cout << std::left << std::setw(16) << "Stage" << std::right << std::setw(12) << "Total (s)"
+              << std::setw(10) << "Count" << std::setw(12) << "Mean (ms)" << std::endl;
+    for (const auto &s : sorted) {
+        std::cout << std::left << std::setw(16) << s.first << std::right << std::setw(12) << std::setprecision(3) << s.second.first / 1e6
+                  << std::setw(10) << s.second.second << std::setw(12) << s.second.first / 1e3 / s.second.second << std::endl;
+    }
+}
+
+// Enables tracing from the environment before main and writes the trace after it returns (or exit)
+static struct TraceAtExit {
+    TraceAtExit() {
+        if (const char* file = std::getenv("ENHANCE_TRACE")) enable_trace(file);
+    }
+    ~TraceAtExit() {
+        if (!tracing) return;
+        if (write_trace(trace_file)) std::cout << "Trace written to " << yellow << trace_file << res << std::endl;
+        print_trace_summary();
+    }
+} trace_at_exit;
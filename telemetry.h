@@ -0,0 +1,122 @@
+/*
+ * telemetry.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Low overhead instrumentation - sharded work counters, a
+ * progress reporter which samples them from its own thread,
+ * and scoped timers recording where the wall time goes.
+ * Spans are only recorded when tracing is enabled (by setting
+ * ENHANCE_TRACE to an output file), in which case a Chrome
+ * trace (chrome://tracing, Perfetto) is written and a per
+ * stage summary printed at exit.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Slots in each [Counter], threads beyond this share slots (still correct, just contended)
+const size_t counter_slots = 64;
+
+// One counter slot per cache line, so threads adding to their own slot never share a line
+struct alignas(64) CounterSlot {
+    std::atomic<size_t> value {0};
+};
+
+// Counter sharded over per-thread slots, [add] is a relaxed add to the calling thread's slot
+// and [total] sums the slots (approximate while other threads are still adding)
+class Counter {
+public:
+    Counter() : slots(counter_slots) {}
+
+    void add(const size_t n = 1);
+    size_t total() const;
+    void reset();
+
+private:
+    std::vector<CounterSlot> slots;
+};
+
+// Percent complete of {total} units of work. Workers only [tick] the counter, the reporter
+// thread samples it every {interval} and redraws when the percentage changes, so progress costs
+// the workers nothing and the terminal is written by one thread. Intermediate percentages are
+// only drawn on a terminal, 100% is drawn when the progress is finished or destroyed. Nothing is
+// drawn for a {total} of 0 or 1.
+class Progress {
+public:
+    Progress(const size_t total, const std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+    ~Progress();
+
+    void tick(const size_t n = 1) { counter.add(n); }
+    size_t done() const { return counter.total(); }
+    void finish();
+
+private:
+    void report();
+    void draw(const size_t done);
+
+    Counter counter;
+    const size_t total;
+    const std::chrono::milliseconds interval;
+    int drawn = -1;             // Last percentage drawn
+
+    bool finished = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread reporter;
+};
+
+// Quiets the per frame status lines (what a routine is doing, then "done.") printed on the
+// calling thread for as long as it lives. Frames processed concurrently each hold one, so that
+// their workers leave the terminal to the [Progress] of the whole run. Errors are still printed.
+class Quiet {
+public:
+    Quiet();
+    ~Quiet();
+
+    Quiet(const Quiet&) = delete;
+    Quiet& operator=(const Quiet&) = delete;
+
+private:
+    const bool was;
+};
+
+// Whether the calling thread is inside a [Quiet] scope
+bool quiet();
+
+// Scoped timer, records the interval from construction to destruction as a span named {name} on
+// the calling thread. {name} must outlive the trace, in practice a string literal. Costs a
+// single relaxed load when tracing is disabled.
+class Span {
+public:
+    explicit Span(const char* name);
+    ~Span();
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name;
+    int64_t start = -1;         // Microseconds since start up, -1 if not recording
+};
+
+// Tracing is enabled at start up if ENHANCE_TRACE is set, and the trace is written to that file
+// at exit. [enable_trace] does the same programmatically.
+void enable_trace(const std::string &file);
+bool trace_enabled();
+
+// Chrome trace event format, with every span as a complete ("X") event on its thread
+bool write_trace(const std::string &file);
+
+// Total, count and mean wall time of each span name, slowest first
+void print_trace_summary();
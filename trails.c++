@@ -0,0 +1,76 @@
+/*
+ * trails.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the incremental star trail accumulator.
+ *
+ */
+
+#include "trails.h"
+#include "enhance.h"
+
+bool StarTrail::add(const cv::Mat &_frame) {
+    Span span("accumulate");
+    // [convertTo] only changes the depth, gray and BGRA frames also need their channels converted
+    cv::Mat frame = _frame;
+    if (frame.depth() != CV_8U) frame.convertTo(frame, CV_8U);
+    if (frame.channels() == 1) cv::cvtColor(frame, frame, cv::COLOR_GRAY2BGR);
+    else if (frame.channels() == 4) cv::cvtColor(frame, frame, cv::COLOR_BGRA2BGR);
+    else if (frame.channels() != 3) return false;
+    if (sum.empty()) {
+        sum = cv::Mat::zeros(frame.rows, frame.cols, CV_32SC3);
+        trail = cv::Mat::zeros(frame.rows, frame.cols, CV_8UC3);
+        level = cv::Mat::zeros(frame.rows, frame.cols, CV_8UC1);
+    }
+    if (frame.rows != sum.rows || frame.cols != sum.cols) return false;
+
+    // The sum and the lighten-max are updated in the same sweep, with the max written as
+    // selects rather than branches so that each row vectorizes
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < frame.rows; r ++) {
+        const uchar* pixel = frame.ptr(r);
+        int32_t* s = sum.ptr<int32_t>(r);
+        uchar* t = trail.ptr(r);
+        uchar* l = level.ptr(r);
+#pragma omp simd
+        for (int c = 0; c < frame.cols; c ++) {
+            const int b0 = pixel[3 * c], b1 = pixel[3 * c + 1], b2 = pixel[3 * c + 2];
+            s[3 * c] += b0;
+            s[3 * c + 1] += b1;
+            s[3 * c + 2] += b2;
+            const int b = (b0 + b1 + b2) / 3;
+            const bool take = b > (int)threshold && b > l[c];
+            l[c] = take ? b : l[c];
+            t[3 * c] = take ? b0 : t[3 * c];
+            t[3 * c + 1] = take ? b1 : t[3 * c + 1];
+            t[3 * c + 2] = take ? b2 : t[3 * c + 2];
+        }
+    }
+    n ++;
+    return true;
+}
+
+cv::Mat StarTrail::composite() const {
+    if (!n) return cv::Mat();
+    cv::Mat out(sum.rows, sum.cols, CV_8UC3);
+    const double scale = 1. / n;
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < sum.rows; r ++) {
+        const int32_t* s = sum.ptr<int32_t>(r);
+        const uchar* t = trail.ptr(r);
+        const uchar* l = level.ptr(r);
+        uchar* o = out.ptr(r);
+        for (int c = 0; c < sum.cols; c ++) {
+            const uchar m0 = cv::saturate_cast<uchar>(s[3 * c] * scale);
+            const uchar m1 = cv::saturate_cast<uchar>(s[3 * c + 1] * scale);
+            const uchar m2 = cv::saturate_cast<uchar>(s[3 * c + 2] * scale);
+            const bool take = l[c] > (m0 + m1 + m2) / 3;
+            o[3 * c] = take ? t[3 * c] : m0;
+            o[3 * c + 1] = take ? t[3 * c + 1] : m1;
+            o[3 * c + 2] = take ? t[3 * c + 2] : m2;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,38 @@
+/*
+ * trails.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Incremental star trail accumulator which keeps the running
+ * sum for the mean background and the brightest pixel seen at
+ * each location, updated together in one pass per frame.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+class StarTrail {
+public:
+    StarTrail(const unsigned threshold = 0) : threshold(threshold) {}
+
+    // Fold {frame} into the trails, converted to CV_8UC3 if it is a gray or BGRA frame or not 8-bit.
+    // False (and ignored) if its shape does not match or it has another number of channels.
+    bool add(const cv::Mat &frame);
+
+    // Mean of the frames so far with every pixel brighter than both the mean and {threshold}
+    // replaced by the brightest value seen there. Identical to blending each frame into the
+    // mean 'lighten-only', but available after every frame at the cost of a single pass.
+    cv::Mat composite() const;
+
+    size_t count() const { return n; }
+
+private:
+    const unsigned threshold;
+    size_t n = 0;
+    cv::Mat sum;        // CV_32SC3 running sum
+    cv::Mat trail;      // CV_8UC3 brightest pixel seen
+    cv::Mat level;      // CV_8UC1 brightness of {trail}, 0 where no pixel has passed {threshold}
+};
@@ -0,0 +1,195 @@
+/*
+ * video.c++
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Implementation of the frame sources, frame pool and
+ * ordered parallel frame sink.
+ *
+ */
+
+#include "video.h"
+#include "enhance.h"
+
+cv::Mat FramePool::acquire(const int rows, const int cols, const int type) {
+    // A buffer is free when the pool holds the only reference to it
+    for (auto &buffer : buffers) {
+        if (CV_XADD(&buffer.u->refcount, 0) != 1) continue;
+        if (buffer.rows != rows || buffer.cols != cols || buffer.type() != type) buffer.create(rows, cols, type);
+        return buffer;
+    }
+    cv::Mat frame(rows, cols, type);
+    if (buffers.size() < capacity) buffers.push_back(frame);
+    return frame;
+}
+
+bool ImageSource::next(cv::Mat &frame) {
+    while (idx < files.size()) {
+        frame = read_image(files[idx++]);
+        if (!frame.empty()) return true;
+    }
+    return false;
+}
+
+VideoSource::VideoSource(const std::vector<std::string> &files) : files(files) {
+    decoded = av_frame_alloc();
+    packet = av_packet_alloc();
+}
+
+VideoSource::~VideoSource() {
+    close();
+    av_frame_free(&decoded);
+    av_packet_free(&packet);
+    sws_freeContext(scaler);
+}
+
+void VideoSource::rewind() {
+    close();
+    idx = 0;
+}
+
+bool VideoSource::open() {
+    // Files which cannot be opened or decoded are reported and skipped
+    while (idx < files.size()) {
+        const std::string &file = files[idx++];
+        char errbuf[1024];
+        int ret;
+        if ((ret = avformat_open_input(&format, file.c_str(), NULL, NULL)) < 0) {
+            av_strerror(ret, errbuf, sizeof(errbuf));
+            std::cout << "Could not open file " << yellow << file << res << ": " << errbuf << std::endl;
+            continue;
+        }
+        if (avformat_find_stream_info(format, NULL) < 0) {
+            std::cout << red << "Failed to read input file information" << res << " for " << yellow << file << res << std::endl;
+            close();
+            continue;
+        }
+        if ((stream = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0) {
+            std::cout << "Could not find a video stream in " << yellow << file << res << std::endl;
+            close();
+            continue;
+        }
+        const AVCodecParameters* parameters = format->streams[stream]->codecpar;
+        const AVCodec* decoder = avcodec_find_decoder(parameters->codec_id);
+        if (decoder == NULL) {
+            std::cout << "Could not find codec: " << avcodec_get_name(parameters->codec_id) << std::endl;
+            close();
+            continue;
+        }
+
+        // A thread count of 0 lets the codec choose, frame threading is what makes long videos
+        // decode at full speed
+        codec = avcodec_alloc_context3(decoder);
+        avcodec_parameters_to_context(codec, parameters);
+        codec->thread_count = 0;
+        codec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        if ((ret = avcodec_open2(codec, decoder, NULL)) < 0) {
+            av_strerror(ret, errbuf, sizeof(errbuf));
+            std::cout << "Could not open codec for " << yellow << file << res << ": " << errbuf << std::endl;
+            close();
+            continue;
+        }
+        // The average rate is 0/0 for some streams (notably GIFs), fall back to the base rate, the
+        // codec's rate and finally the stream time base when it is a plausible frame rate
+        const AVStream* st = format->streams[stream];
+        rate = 0;
+        for (const AVRational q : {st->avg_frame_rate, st->r_frame_rate, codec->framerate, av_inv_q(st->time_base)}) {
+            const double r = q.den ? av_q2d(q) : 0;
+            if (std::isfinite(r) && r > 0 && r <= 1000) {
+                rate = r;
+                break;
+            }
+        }
+        draining = false;
+        std::cout << "Decoding " << yellow << file << res << "..." << std::endl;
+        return true;
+    }
+    return false;
+}
+
+void VideoSource::close() {
+    if (codec) avcodec_free_context(&codec);
+    if (format) avformat_close_input(&format);
+    stream = -1;
+}
+
+bool VideoSource::next(cv::Mat &frame) {
+    Span span("decode");
+    while (codec || open()) {
+        int ret = avcodec_receive_frame(codec, decoded);
+        if (ret == 0) {
+            // Convert straight into a pooled buffer, the scaler is only rebuilt if the
+            // dimensions or pixel format change
+            const int w = decoded->width, h = decoded->height;
+            frame = pool.acquire(h, w, CV_8UC3);
+            scaler = sws_getCachedContext(scaler, w, h, (AVPixelFormat)decoded->format, w, h, AV_PIX_FMT_BGR24,
+                                          SWS_BICUBIC, NULL, NULL, NULL);
+            uint8_t* dst[] = {frame.data};
+            const int stride[] = {(int)frame.step};
+            sws_scale(scaler, decoded->data, decoded->linesize, 0, h, dst, stride);
+            av_frame_unref(decoded);
+            return true;
+        }
+        if (ret != AVERROR(EAGAIN) || draining) {
+            // End of this file (or a decoding error), move on to the next
+            if (ret != AVERROR_EOF && ret != AVERROR(EAGAIN)) {
+                char errbuf[1024];
+                av_strerror(ret, errbuf, sizeof(errbuf));
+                std::cout << red << "Decoding error" << res << ": " << errbuf << std::endl;
+            }
+            close();
+            continue;
+        }
+
+        // The decoder needs more input, at the end of the file send the flush packet
+        if (av_read_frame(format, packet) < 0) {
+            avcodec_send_packet(codec, NULL);
+            draining = true;
+            continue;
+        }
+        if (packet->stream_index == stream) avcodec_send_packet(codec, packet);
+        av_packet_unref(packet);
+    }
+    return false;
+}
+
+size_t map_frames(FrameSource &source, const std::function<cv::Mat(const cv::Mat&)> &fn,
+                  const std::function<void(const cv::Mat&)> &write, const size_t threads) {
+    // Finished frames wait in {results} until every earlier frame has been written
+    ThreadPool pool(threads);
+    const size_t depth = 2 * pool.size();
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::map<size_t, cv::Mat> results;
+
+    size_t read = 0, written = 0;
+    bool more = true;
+    cv::Mat frame;
+    while (true) {
+        while (more && read - written < depth && (more = source.next(frame))) {
+            pool.submit([&, index = read, frame] {
+                cv::Mat out = fn(frame);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    results[index] = out;
+                }
+                ready.notify_one();
+            });
+            frame.release();
+            read ++;
+        }
+        if (written == read) break;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&] { return results.count(written); });
+        cv::Mat out = results[written];
+        results.erase(written);
+        lock.unlock();
+
+        write(out);
+        written ++;
+    }
+    pool.wait();
+    return written;
+}
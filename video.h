@@ -0,0 +1,100 @@
+/*
+ * video.h
+ *
+ * William Miller
+ * Oct 17, 2026
+ *
+ * Lazily decoded frame sources for image lists and video
+ * files, and a sink which maps frames in parallel and
+ * writes the results back in order.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+
+// Recycles frame buffers once every [cv::Mat] handed out from them has been released, so a
+// consumer which drops its frames promptly costs no allocations after the first few frames
+class FramePool {
+public:
+    FramePool(const size_t capacity = 16) : capacity(capacity) {}
+    cv::Mat acquire(const int rows, const int cols, const int type);
+
+private:
+    const size_t capacity;
+    std::vector<cv::Mat> buffers;
+};
+
+// A stream of BGR (CV_8UC3) frames decoded one at a time as they are requested
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+    virtual bool next(cv::Mat &frame) = 0;      // Decode the next frame into {frame}, false once exhausted
+    virtual void rewind() = 0;                  // Start again from the first frame
+    virtual double fps() const { return 0; }    // Frame rate if known, 0 otherwise
+    virtual size_t size() const { return 0; }   // Number of frames (at most) if known, 0 otherwise
+};
+
+// Frames from a list of image files, files which fail to read are skipped
+class ImageSource : public FrameSource {
+public:
+    ImageSource(const std::vector<std::string> &files) : files(files) {}
+    bool next(cv::Mat &frame) override;
+    size_t size() const override { return files.size(); }
+    void rewind() override { idx = 0; }
+
+private:
+    const std::vector<std::string> files;
+    size_t idx = 0;
+};
+
+// Frames from the best video stream of each of {files} in turn. Uses the send/receive decoding
+// API with the codec's own frame and slice threading, converts through one cached scaler and
+// hands out buffers from a [FramePool].
+class VideoSource : public FrameSource {
+public:
+    VideoSource(const std::vector<std::string> &files);
+    ~VideoSource();
+    VideoSource(const VideoSource&) = delete;
+    VideoSource& operator=(const VideoSource&) = delete;
+
+    bool next(cv::Mat &frame) override;
+    void rewind() override;
+    double fps() const override { return rate; }
+
+private:
+    bool open();                                // Open files[idx], false if there are no more files
+    void close();
+
+    const std::vector<std::string> files;
+    size_t idx = 0;
+    double rate = 0;
+    int stream = -1;
+    bool draining = false;
+
+    AVFormatContext* format = nullptr;
+    AVCodecContext* codec = nullptr;
+    AVFrame* decoded = nullptr;
+    AVPacket* packet = nullptr;
+    SwsContext* scaler = nullptr;
+    FramePool pool;
+};
+
+// Read every frame of {source} on the calling thread, apply {fn} to the frames on {threads} workers
+// and pass the results to {write} in source order. Keeps at most two frames per worker in flight.
+// Returns the number of frames written.
+size_t map_frames(FrameSource &source, const std::function<cv::Mat(const cv::Mat&)> &fn,
+                  const std::function<void(const cv::Mat&)> &write,
+                  const size_t threads = std::thread::hardware_concurrency());